@@ -0,0 +1,389 @@
+#define OK_IMPLEMENTATION
+#include "../ok_code.h"
+#include "../ok_prof.h"
+#include "../ok_tier.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// benchmark harness: runs each workload ROM to completion under each of the
+// VM's run loops and reports hardware counters per guest instruction, and
+// each run loop's speed relative to ok_tick on the same ROM. Counters come
+// from Linux perf_event_open; any that can't be opened (other OSes,
+// containers, perf_event_paranoid) are reported as missing and the rest
+// still run. Naming the ROM :hot-loop runs a built-in countdown loop instead
+// of a file.
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#define CACHE_EVENT(cache, op, result) \
+  ((cache) | ((op) << 8) | ((result) << 16))
+
+typedef struct {
+  const char* name;
+  uint32_t type;
+  uint64_t config;
+} Counter;
+
+#ifdef __linux__
+static const Counter counters[] = {
+  { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+  { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+  { "branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+  { "l1d-misses", PERF_TYPE_HW_CACHE, CACHE_EVENT(PERF_COUNT_HW_CACHE_L1D,
+    PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS) },
+  { "llc-misses", PERF_TYPE_HW_CACHE, CACHE_EVENT(PERF_COUNT_HW_CACHE_LL,
+    PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS) },
+  { "itlb-misses", PERF_TYPE_HW_CACHE, CACHE_EVENT(PERF_COUNT_HW_CACHE_ITLB,
+    PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS) },
+};
+#else
+static const Counter counters[] = {
+  { "cycles", 0, 0 },
+  { "instructions", 0, 0 },
+  { "branch-misses", 0, 0 },
+  { "l1d-misses", 0, 0 },
+  { "llc-misses", 0, 0 },
+  { "itlb-misses", 0, 0 },
+};
+#endif
+
+#define NCOUNTERS (sizeof(counters) / sizeof(counters[0]))
+
+// instructions of the built-in workload
+#define LIT3 (0b10101101)
+#define ADD3 (0b10100000)
+#define CMP3 (0b10100101)
+#define DUP3 (0b10101000)
+#define JMP3_SKIP (0b11101100)
+
+// :hot-loop, counting down from 1050000: one small block jumped to over and
+// over, the case decoding and tiering are for
+static const uint8_t hot_loop[] = {
+  LIT3, 0x10, 0x05, 0x90,
+  LIT3, 0xff, 0xff, 0xff, ADD3, // 4: count down
+  DUP3, LIT3, 0, 0, 0, CMP3,
+  LIT3, 0, 0, 4, JMP3_SKIP, // loop while nonzero
+  0,
+};
+
+// a run loop: runs vm for at most max instructions, returning how many ran
+typedef uint64_t (*RunLoop)(OkState* vm, uint64_t max);
+
+typedef struct {
+  const char* name;
+  RunLoop run;
+} Engine;
+
+typedef struct {
+  const char* rom;
+  const char* engine;
+  OkStatus status;
+  uint64_t ticks; // guest instructions
+  double seconds;
+  int have[NCOUNTERS]; // whether each counter could be read
+  uint64_t value[NCOUNTERS];
+} Result;
+
+// defining the buffers for the VM to use
+static uint8_t* ram;
+static uint8_t* program;
+
+uint8_t ok_mem_read(size_t address) {
+  return ram[address];
+}
+
+void ok_mem_write(size_t address, uint8_t val) {
+  ram[address] = val; // output devices are left out on purpose
+}
+
+uint8_t ok_fetch(size_t address) {
+  return program[address];
+}
+
+static uint64_t run_tick(OkState* vm, uint64_t max) {
+  uint64_t ticks = 0;
+  while (vm->status == OK_RUNNING && ticks < max) {
+    ok_tick(vm);
+    ticks++;
+  }
+  return ticks;
+}
+
+// default costs charge 1 per instruction, so fuel counts instructions
+static uint64_t run_metered(OkState* vm, uint64_t max) {
+  static OkMeter meter;
+  ok_meter_init(&meter, max);
+  ok_run_metered(vm, &meter);
+  // every instruction costs 1 by default, except a halt, which is free
+  return meter.used + (vm->status == OK_HALTED);
+}
+
+// decoding is part of the measurement, as it would be at startup
+static uint64_t run_code(OkState* vm, uint64_t max) {
+  OkCode* code = ok_code_build(program, OK_MEM_SIZE);
+  if (!code) return 0;
+  uint64_t ran = ok_code_run(code, vm, max);
+  ok_code_free(code);
+  return ran;
+}
+
+// sampling at a typical rate, to keep an eye on the profiler's overhead
+static uint64_t run_prof(OkState* vm, uint64_t max) {
+  static OkProf prof;
+  if (!prof.stacks && !ok_prof_init(&prof, 10007)) return 0;
+  return ok_prof_run(&prof, vm, max);
+}
+
+// tiering decides for itself whether decoding is worth it
+static uint64_t run_tier(OkState* vm, uint64_t max) {
+  static OkTier tier;
+  if (!ok_tier_init(&tier, program, OK_MEM_SIZE, OK_TIER_THRESHOLD)) return 0;
+  uint64_t ran = ok_tier_run(&tier, vm, max);
+  ok_tier_free(&tier);
+  return ran;
+}
+
+static const Engine engines[] = {
+  { "tick", run_tick },
+  { "metered", run_metered },
+  { "code", run_code },
+  { "prof", run_prof },
+  { "tier", run_tier },
+};
+
+#define NENGINES (sizeof(engines) / sizeof(engines[0]))
+
+// open a counter for this thread, disabled; returns -1 if unavailable
+static int counter_open(const Counter* c) {
+#ifdef __linux__
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = c->type;
+  attr.config = c->config;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+  (void) c;
+  return -1;
+#endif
+}
+
+static void counter_ctl(int fd, int enable) {
+#ifdef __linux__
+  if (fd < 0) return;
+  if (enable) {
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+  } else {
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+  }
+#else
+  (void) fd;
+  (void) enable;
+#endif
+}
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// run the loaded ROM repeat times, summing the counters over every run
+static void bench(Result* res, RunLoop run, int repeat, uint64_t max_ticks) {
+  int fds[NCOUNTERS];
+  for (size_t i = 0; i < NCOUNTERS; i++) {
+    fds[i] = counter_open(&counters[i]);
+    res->have[i] = fds[i] >= 0;
+    res->value[i] = 0;
+  }
+  res->ticks = 0;
+  res->seconds = 0;
+
+  for (int rep = 0; rep < repeat; rep++) {
+    memset(ram, 0, OK_MEM_SIZE);
+    OkState vm;
+    ok_init(&vm);
+
+    double start = now();
+    for (size_t i = 0; i < NCOUNTERS; i++) counter_ctl(fds[i], 1);
+    uint64_t ticks = run(&vm, max_ticks);
+    for (size_t i = 0; i < NCOUNTERS; i++) counter_ctl(fds[i], 0);
+    res->seconds += now() - start;
+
+    for (size_t i = 0; i < NCOUNTERS; i++) {
+      uint64_t v;
+      if (fds[i] < 0) continue;
+      if (read(fds[i], &v, sizeof(v)) != sizeof(v)) res->have[i] = 0;
+      else res->value[i] += v;
+    }
+    res->ticks += ticks;
+    res->status = vm.status;
+  }
+
+  for (size_t i = 0; i < NCOUNTERS; i++) {
+    if (fds[i] >= 0) close(fds[i]);
+  }
+}
+
+// how many times faster than ok_tick, the first engine, on the same ROM
+static double vs_tick(const Result* res, int r) {
+  const Result* tick = &res[r - r % NENGINES];
+  double ns = res[r].ticks ? res[r].seconds / res[r].ticks : 0;
+  double tick_ns = tick->ticks ? tick->seconds / tick->ticks : 0;
+  return ns > 0 ? tick_ns / ns : 0;
+}
+
+static void print_table(const Result* res, int n) {
+  printf("%-24s %-8s %12s %10s %8s", "rom", "engine", "guest-insns",
+    "ns/insn", "vs-tick");
+  for (size_t i = 0; i < NCOUNTERS; i++) printf(" %13s", counters[i].name);
+  printf("\n");
+
+  for (int r = 0; r < n; r++) {
+    double per = res[r].ticks ? (double) res[r].ticks : 1;
+    printf("%-24s %-8s %12llu %10.2f %7.2fx", res[r].rom, res[r].engine,
+      (unsigned long long) res[r].ticks, res[r].seconds * 1e9 / per,
+      vs_tick(res, r));
+    for (size_t i = 0; i < NCOUNTERS; i++) {
+      if (res[r].have[i]) printf(" %13.3f", res[r].value[i] / per);
+      else printf(" %13s", "n/a");
+    }
+    printf("\n");
+  }
+  printf("(counters are per guest instruction)\n");
+}
+
+// print s as a JSON string
+static void print_json_string(FILE* f, const char* s) {
+  fputc('"', f);
+  for (; *s; s++) {
+    unsigned char c = (unsigned char) *s;
+    if (c == '"' || c == '\\') {
+      fprintf(f, "\\%c", c);
+    } else if (c < 0x20) {
+      fprintf(f, "\\u%04x", c);
+    } else {
+      fputc(c, f);
+    }
+  }
+  fputc('"', f);
+}
+
+static void print_json(FILE* f, const Result* res, int n) {
+  fprintf(f, "[\n");
+  for (int r = 0; r < n; r++) {
+    double per = res[r].ticks ? (double) res[r].ticks : 1;
+    fprintf(f, "  {\"rom\": ");
+    print_json_string(f, res[r].rom);
+    fprintf(f, ", \"engine\": ");
+    print_json_string(f, res[r].engine);
+    fprintf(f, ", \"halted\": %s, "
+      "\"guest_insns\": %llu, \"seconds\": %.9f, \"ns_per_insn\": %.4f, "
+      "\"vs_tick\": %.4f",
+      res[r].status == OK_HALTED ? "true" : "false",
+      (unsigned long long) res[r].ticks, res[r].seconds,
+      res[r].seconds * 1e9 / per, vs_tick(res, r));
+    for (size_t i = 0; i < NCOUNTERS; i++) {
+      if (res[r].have[i]) {
+        fprintf(f, ", \"%s\": %llu, \"%s_per_insn\": %.6f", counters[i].name,
+          (unsigned long long) res[r].value[i], counters[i].name,
+          res[r].value[i] / per);
+      } else {
+        fprintf(f, ", \"%s\": null", counters[i].name);
+      }
+    }
+    fprintf(f, "}%s\n", r + 1 < n ? "," : "");
+  }
+  fprintf(f, "]\n");
+}
+
+int main(int argc, char* argv[]) {
+  int repeat = 1;
+  uint64_t max_ticks = 1000000000;
+  const char* json = NULL;
+
+  int first = 1;
+  for (; first < argc && argv[first][0] == '-'; first++) {
+    if (!strcmp(argv[first], "-n") && first + 1 < argc) {
+      repeat = atoi(argv[++first]);
+    } else if (!strcmp(argv[first], "-m") && first + 1 < argc) {
+      max_ticks = strtoull(argv[++first], NULL, 10);
+    } else if (!strcmp(argv[first], "-j") && first + 1 < argc) {
+      json = argv[++first];
+    } else {
+      break;
+    }
+  }
+  if (first >= argc || repeat < 1) {
+    printf("usage: okbench [-n repeats] [-m max-ticks] [-j out.json] "
+      "file.rom|:hot-loop...\n");
+    return 1;
+  }
+
+  // allocate the ram and program buffers
+  ram = calloc(OK_MEM_SIZE, 1);
+  program = calloc(OK_MEM_SIZE, 1);
+  int n = (argc - first) * NENGINES;
+  Result* res = calloc(n, sizeof(Result));
+  if (!ram || !program || !res) {
+    free(ram);
+    free(program);
+    free(res);
+    return 1;
+  }
+
+  int failed = 0;
+  int missing = 0; // counters unavailable in any run that happened
+  for (int r = 0; r < n; r += NENGINES) {
+    const char* rom = argv[first + r / NENGINES];
+    memset(program, 0, OK_MEM_SIZE);
+    int loaded = 1;
+    if (!strcmp(rom, ":hot-loop")) memcpy(program, hot_loop, sizeof(hot_loop));
+    else loaded = ok_load_file(program, 0, rom);
+    if (!loaded) {
+      fprintf(stderr, "okbench: can't load %s\n", rom);
+      failed = 1;
+    }
+
+    for (size_t e = 0; e < NENGINES; e++) {
+      res[r + e].rom = rom;
+      res[r + e].engine = engines[e].name;
+      if (!loaded) continue;
+      bench(&res[r + e], engines[e].run, repeat, max_ticks);
+      for (size_t i = 0; i < NCOUNTERS; i++) missing |= !res[r + e].have[i];
+    }
+  }
+
+  if (missing) {
+    fprintf(stderr, "okbench: some hardware counters are unavailable "
+      "(check /proc/sys/kernel/perf_event_paranoid)\n");
+  }
+
+  print_table(res, n);
+  if (json) {
+    FILE* f = fopen(json, "w");
+    if (f) {
+      print_json(f, res, n);
+      fclose(f);
+    } else {
+      fprintf(stderr, "okbench: can't write %s\n", json);
+      failed = 1;
+    }
+  }
+
+  free(ram);
+  free(program);
+  free(res);
+  return failed;
+}
@@ -0,0 +1,439 @@
+#define OK_IMPLEMENTATION
+#include "../ok.h"
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+// request server: loads a ROM once and runs it once per request, on a pool
+// of worker threads that each keep a VM and its RAM ready to go, so a
+// request costs a run of the guest rather than a process, two OK_MEM_SIZE
+// allocations and a ROM load like okmin does.
+//
+// Requests come over a Unix domain socket, any number per connection, each
+// a 4-byte big-endian payload length followed by the payload. The payload
+// is put in guest RAM at OKD_IN, with its length in the 3-byte word at
+// OKD_IN_LEN, and the guest is run from the start until it stops or uses up
+// its instruction budget. It leaves its output at OKD_OUT, with the length
+// in the word at OKD_OUT_LEN. Each response is the status the guest stopped
+// with (an OkStatus, or OKD_REFUSED for a payload over OKD_MAX bytes, which
+// also closes the connection), a 4-byte big-endian output length and the
+// output.
+//
+// A dispatcher thread polls every open connection and queues the ones with
+// a request waiting. The next idle worker serves just that request and
+// hands the connection back, so workers are tied to requests rather than
+// connections, and any number of persistent clients share the pool.
+//
+// Between requests a worker only zeroes the RAM pages the last one wrote to.
+// On SIGINT or SIGTERM, or after -n requests, okd prints the latency
+// percentiles and throughput it served at, and the guest instructions run
+// per request, halts included.
+
+#define OKD_IN_LEN (0xdffffd) // payload length, written by okd
+#define OKD_IN (0xe00000) // payload, written by okd
+#define OKD_OUT_LEN (0xeffffd) // output length, written by the guest
+#define OKD_OUT (0xf00000) // output, written by the guest
+#define OKD_MAX (0x0f0000) // most bytes of payload or output
+#define OKD_REFUSED (0xff) // response status for an oversized payload
+
+#define OKD_PAGE_BITS (12)
+#define OKD_PAGES (OK_MEM_SIZE >> OKD_PAGE_BITS)
+
+typedef struct {
+  pthread_t thread;
+  uint8_t* ram;
+  uint64_t dirty[OKD_PAGES / 64]; // pages written since the last reset
+  uint32_t touched[OKD_PAGES]; // the same pages, as a list
+  uint32_t ntouched;
+  OkMeter meter; // kept between requests, as the ROM never changes
+} Worker;
+
+// latencies of every request served, shared by the workers
+typedef struct {
+  pthread_mutex_t lock;
+  uint64_t* ns;
+  size_t n, cap;
+  uint64_t instructions; // run by the guest, halts included
+  uint64_t status[4]; // requests by OkStatus
+  uint64_t refused;
+  double first, last; // when the first request came and the last one left
+} Stats;
+
+// connections with a request waiting, for the workers to take
+typedef struct {
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  int* fds;
+  size_t head, len, cap;
+} Queue;
+
+static uint8_t* program;
+static int listener;
+static int wake[2]; // workers write connections back to the dispatcher here
+static Queue queue = {
+  .lock = PTHREAD_MUTEX_INITIALIZER, .ready = PTHREAD_COND_INITIALIZER
+};
+static uint64_t budget = 100000000; // most instructions per request
+static uint64_t limit; // requests to serve before stopping, 0 for no limit
+static Stats stats = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+// the worker running on this thread
+static _Thread_local Worker* self;
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// remember a page needs zeroing before the next request
+static inline void okd_touch(Worker* w, size_t address) {
+  size_t page = address >> OKD_PAGE_BITS;
+  uint64_t bit = (uint64_t) 1 << (page % 64);
+  if (w->dirty[page / 64] & bit) return;
+  w->dirty[page / 64] |= bit;
+  w->touched[w->ntouched++] = (uint32_t) page;
+}
+
+// addresses wrap, so multi-byte accesses at the top of RAM stay in it
+uint8_t ok_mem_read(size_t address) {
+  return self->ram[address & (OK_MEM_SIZE - 1)];
+}
+
+void ok_mem_write(size_t address, uint8_t val) {
+  address &= OK_MEM_SIZE - 1;
+  okd_touch(self, address);
+  self->ram[address] = val;
+}
+
+uint8_t ok_fetch(size_t address) {
+  return program[address & (OK_MEM_SIZE - 1)];
+}
+
+// zero what the last request wrote, leaving RAM as it was at startup
+static void okd_reset(Worker* w) {
+  for (uint32_t i = 0; i < w->ntouched; i++) {
+    size_t page = w->touched[i];
+    memset(w->ram + (page << OKD_PAGE_BITS), 0, 1 << OKD_PAGE_BITS);
+    w->dirty[page / 64] = 0;
+  }
+  w->ntouched = 0;
+}
+
+// read exactly len bytes. Returns 1 on success, 0 on failure or end of file.
+static int okd_read(int fd, uint8_t* buf, size_t len) {
+  while (len > 0) {
+    ssize_t got = read(fd, buf, len);
+    if (got < 0 && errno == EINTR) continue;
+    if (got <= 0) return 0;
+    buf += got;
+    len -= got;
+  }
+  return 1;
+}
+
+// write all of iov. Returns 1 on success, 0 on failure.
+static int okd_writev(int fd, struct iovec* iov, int n) {
+  while (n > 0) {
+    ssize_t put = writev(fd, iov, n);
+    if (put < 0 && errno == EINTR) continue;
+    if (put < 0) return 0;
+    for (; n > 0 && (size_t) put >= iov->iov_len; iov++, n--) {
+      put -= iov->iov_len;
+    }
+    if (n > 0) {
+      iov->iov_base = (uint8_t*) iov->iov_base + put;
+      iov->iov_len -= put;
+    }
+  }
+  return 1;
+}
+
+static void okd_record(double start, double end, int status,
+                       uint64_t instructions) {
+  pthread_mutex_lock(&stats.lock);
+  if (stats.n == stats.cap) {
+    size_t cap = stats.cap ? 2 * stats.cap : 4096;
+    uint64_t* ns = realloc(stats.ns, cap * sizeof(uint64_t));
+    if (ns) {
+      stats.ns = ns;
+      stats.cap = cap;
+    }
+  }
+  if (stats.n < stats.cap) stats.ns[stats.n++] = (end - start) * 1e9;
+  if (stats.first == 0 || start < stats.first) stats.first = start;
+  if (end > stats.last) stats.last = end;
+  stats.instructions += instructions;
+  if (status == OKD_REFUSED) stats.refused++;
+  else stats.status[status]++;
+  size_t served = stats.n;
+  pthread_mutex_unlock(&stats.lock);
+
+  if (limit && served == limit) kill(getpid(), SIGTERM);
+}
+
+// serve the next request on a connection. Returns 1 if the connection stays
+// open, 0 if it closed or has to be.
+static int okd_serve(Worker* w, int fd) {
+  uint8_t head[5];
+  if (!okd_read(fd, head, 4)) return 0;
+  double start = now();
+  uint32_t len = ok_get_bytes(head, 0, 4);
+  if (len > OKD_MAX) {
+    head[0] = OKD_REFUSED;
+    ok_set_bytes(head, 1, 4, 0);
+    struct iovec iov[] = { { head, 5 } };
+    okd_writev(fd, iov, 1);
+    okd_record(start, now(), OKD_REFUSED, 0);
+    return 0;
+  }
+
+  for (size_t a = OKD_IN_LEN; a < OKD_IN + len; a += 1 << OKD_PAGE_BITS) {
+    okd_touch(w, a);
+  }
+  okd_touch(w, OKD_IN + len);
+  ok_set_bytes(w->ram, OKD_IN_LEN, 3, len);
+  if (!okd_read(fd, w->ram + OKD_IN, len)) {
+    okd_reset(w);
+    return 0;
+  }
+
+  OkState vm;
+  ok_init(&vm);
+  w->meter.fuel = budget;
+  w->meter.used = 0;
+  ok_run_metered(&vm, &w->meter);
+
+  uint32_t out = ok_get_bytes(w->ram, OKD_OUT_LEN, 3);
+  if (out > OKD_MAX) out = OKD_MAX;
+  head[0] = (uint8_t) vm.status;
+  ok_set_bytes(head, 1, 4, out);
+  struct iovec iov[] = { { head, 5 }, { w->ram + OKD_OUT, out } };
+  int sent = okd_writev(fd, iov, 2);
+  okd_reset(w);
+
+  // every instruction costs 1 by default, except a halt, which is free
+  uint64_t ran = w->meter.used + (vm.status == OK_HALTED);
+  okd_record(start, now(), vm.status, ran);
+  return sent;
+}
+
+static void okd_push(int fd) {
+  pthread_mutex_lock(&queue.lock);
+  if (queue.len == queue.cap) {
+    size_t cap = queue.cap ? 2 * queue.cap : 64;
+    int* fds = malloc(cap * sizeof(int));
+    if (!fds) {
+      pthread_mutex_unlock(&queue.lock);
+      close(fd);
+      return;
+    }
+    for (size_t i = 0; i < queue.len; i++) {
+      fds[i] = queue.fds[(queue.head + i) % queue.cap];
+    }
+    free(queue.fds);
+    queue.fds = fds;
+    queue.head = 0;
+    queue.cap = cap;
+  }
+  queue.fds[(queue.head + queue.len++) % queue.cap] = fd;
+  pthread_cond_signal(&queue.ready);
+  pthread_mutex_unlock(&queue.lock);
+}
+
+static int okd_pop() {
+  pthread_mutex_lock(&queue.lock);
+  while (queue.len == 0) pthread_cond_wait(&queue.ready, &queue.lock);
+  int fd = queue.fds[queue.head];
+  queue.head = (queue.head + 1) % queue.cap;
+  queue.len--;
+  pthread_mutex_unlock(&queue.lock);
+  return fd;
+}
+
+static void* okd_worker(void* arg) {
+  Worker* w = arg;
+  self = w;
+  for (;;) {
+    int fd = okd_pop();
+    if (okd_serve(w, fd)) {
+      while (write(wake[1], &fd, sizeof(fd)) < 0 && errno == EINTR);
+    } else {
+      close(fd);
+    }
+  }
+  return NULL;
+}
+
+// watch the listener and every idle connection, queueing those with a
+// request waiting. The first two entries are the listener and the wake pipe.
+static void* okd_dispatch(void* arg) {
+  (void) arg;
+  size_t n = 2, cap = 64;
+  struct pollfd* fds = malloc(cap * sizeof(struct pollfd));
+  if (!fds) return NULL;
+  fds[0] = (struct pollfd) { .fd = listener, .events = POLLIN };
+  fds[1] = (struct pollfd) { .fd = wake[0], .events = POLLIN };
+
+  for (;;) {
+    if (poll(fds, n, -1) < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+
+    // requests waiting go to the workers, and aren't watched meanwhile
+    for (size_t i = 2; i < n;) {
+      if (fds[i].revents) {
+        okd_push(fds[i].fd);
+        fds[i] = fds[--n];
+      } else {
+        i++;
+      }
+    }
+
+    // make room for a new connection and one the workers are done with
+    if (n + 2 > cap) {
+      struct pollfd* grown = realloc(fds, 2 * cap * sizeof(struct pollfd));
+      if (!grown) continue;
+      fds = grown;
+      cap *= 2;
+    }
+
+    // and watch them, one of each per round; poll sees the rest next time
+    int fd;
+    if ((fds[0].revents & POLLIN)
+        && (fd = accept(listener, NULL, NULL)) >= 0) {
+      fds[n++] = (struct pollfd) { .fd = fd, .events = POLLIN };
+    }
+    if ((fds[1].revents & POLLIN)
+        && read(wake[0], &fd, sizeof(fd)) == sizeof(fd)) {
+      fds[n++] = (struct pollfd) { .fd = fd, .events = POLLIN };
+    }
+  }
+  free(fds);
+  return NULL;
+}
+
+static int compare_u64(const void* a, const void* b) {
+  uint64_t x = *(const uint64_t*) a, y = *(const uint64_t*) b;
+  return (x > y) - (x < y);
+}
+
+static double percentile(const uint64_t* sorted, size_t n, double p) {
+  if (n == 0) return 0;
+  size_t i = (size_t) (p * (n - 1) + 0.5);
+  return sorted[i] / 1e3;
+}
+
+static void print_report() {
+  pthread_mutex_lock(&stats.lock);
+  qsort(stats.ns, stats.n, sizeof(uint64_t), compare_u64);
+  double span = stats.last - stats.first;
+  size_t n = stats.n;
+  printf("requests: %zu served, %llu of them refused\n", n,
+    (unsigned long long) stats.refused);
+  printf("status: %llu halted, %llu panicked, %llu out of fuel\n",
+    (unsigned long long) stats.status[OK_HALTED],
+    (unsigned long long) stats.status[OK_PANIC],
+    (unsigned long long) stats.status[OK_OUT_OF_FUEL]);
+  printf("latency (us): p50 %.1f, p99 %.1f, max %.1f\n",
+    percentile(stats.ns, n, 0.5), percentile(stats.ns, n, 0.99),
+    percentile(stats.ns, n, 1.0));
+  printf("throughput: %.0f requests/s, %.1f guest instructions/request\n",
+    span > 0 ? n / span : 0.0,
+    n ? (double) stats.instructions / n : 0.0);
+  pthread_mutex_unlock(&stats.lock);
+}
+
+int main(int argc, char* argv[]) {
+  int workers = 4;
+
+  int first = 1;
+  for (; first < argc && argv[first][0] == '-'; first++) {
+    if (!strcmp(argv[first], "-w") && first + 1 < argc) {
+      workers = atoi(argv[++first]);
+    } else if (!strcmp(argv[first], "-m") && first + 1 < argc) {
+      budget = strtoull(argv[++first], NULL, 10);
+    } else if (!strcmp(argv[first], "-n") && first + 1 < argc) {
+      limit = strtoull(argv[++first], NULL, 10);
+    } else {
+      break;
+    }
+  }
+  if (argc - first != 2 || workers < 1) {
+    printf("usage: okd [-w workers] [-m max-ticks] [-n requests] "
+      "socket file.rom\n");
+    return 1;
+  }
+  const char* path = argv[first];
+
+  // the ROM is loaded once and shared by every worker
+  program = calloc(OK_MEM_SIZE, 1);
+  Worker* pool = calloc(workers, sizeof(Worker));
+  if (!program || !pool || !ok_load_file(program, 0, argv[first + 1])) {
+    fprintf(stderr, "okd: can't load %s\n", argv[first + 1]);
+    free(program);
+    free(pool);
+    return 1;
+  }
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "okd: socket path too long\n");
+    return 1;
+  }
+  strcpy(addr.sun_path, path);
+  unlink(path);
+  listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener < 0 || bind(listener, (struct sockaddr*) &addr,
+      sizeof(addr)) != 0 || listen(listener, 128) != 0) {
+    fprintf(stderr, "okd: can't listen on %s\n", path);
+    return 1;
+  }
+
+  // signals are only taken by the main thread, in sigwait below
+  sigset_t stop;
+  sigemptyset(&stop);
+  sigaddset(&stop, SIGINT);
+  sigaddset(&stop, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &stop, NULL);
+  signal(SIGPIPE, SIG_IGN); // clients hanging up are seen by writev
+
+  pthread_t dispatcher;
+  if (pipe(wake) != 0
+      || pthread_create(&dispatcher, NULL, okd_dispatch, NULL) != 0) {
+    fprintf(stderr, "okd: can't start the dispatcher\n");
+    return 1;
+  }
+  for (int i = 0; i < workers; i++) {
+    pool[i].ram = calloc(OK_MEM_SIZE, 1);
+    ok_meter_init(&pool[i].meter, 0);
+    if (!pool[i].ram
+        || pthread_create(&pool[i].thread, NULL, okd_worker, &pool[i]) != 0) {
+      fprintf(stderr, "okd: can't start worker %d\n", i);
+      return 1;
+    }
+  }
+  printf("okd: %d workers listening on %s\n", workers, path);
+  fflush(stdout);
+
+  int sig;
+  sigwait(&stop, &sig);
+
+  // the dispatcher and workers may be busy; exiting takes them down with it
+  close(listener);
+  unlink(path);
+  print_report();
+  return 0;
+}
@@ -0,0 +1,225 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+// load generator for okd: opens -c connections, each on its own thread,
+// sends -n requests down each one back to back, and reports the round trip
+// latency percentiles and throughput seen. The payload is the contents of a
+// file, or empty without one; -v prints the output of the first response.
+
+typedef struct {
+  pthread_t thread;
+  const char* path;
+  const uint8_t* payload;
+  uint32_t len;
+  int requests;
+  int verbose;
+  uint64_t* ns; // round trip of each request
+  int done;
+  uint64_t status[256]; // responses by status
+} Conn;
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int read_all(int fd, uint8_t* buf, size_t len) {
+  while (len > 0) {
+    ssize_t got = read(fd, buf, len);
+    if (got < 0 && errno == EINTR) continue;
+    if (got <= 0) return 0;
+    buf += got;
+    len -= got;
+  }
+  return 1;
+}
+
+static int write_all(int fd, const uint8_t* buf, size_t len) {
+  while (len > 0) {
+    ssize_t put = write(fd, buf, len);
+    if (put < 0 && errno == EINTR) continue;
+    if (put < 0) return 0;
+    buf += put;
+    len -= put;
+  }
+  return 1;
+}
+
+static uint32_t get_be32(const uint8_t* b) {
+  return (uint32_t) b[0] << 24 | b[1] << 16 | b[2] << 8 | b[3];
+}
+
+static void* run_conn(void* arg) {
+  Conn* c = arg;
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, c->path, sizeof(addr.sun_path) - 1);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+    fprintf(stderr, "okdclient: can't connect to %s\n", c->path);
+    if (fd >= 0) close(fd);
+    return NULL;
+  }
+
+  // the request is the same every time, length and all
+  uint8_t* req = malloc(4 + (size_t) c->len);
+  uint8_t* out = NULL;
+  size_t out_cap = 0;
+  if (!req) {
+    close(fd);
+    return NULL;
+  }
+  req[0] = c->len >> 24;
+  req[1] = c->len >> 16;
+  req[2] = c->len >> 8;
+  req[3] = c->len;
+  memcpy(req + 4, c->payload, c->len);
+
+  for (; c->done < c->requests; c->done++) {
+    double start = now();
+    uint8_t head[5];
+    if (!write_all(fd, req, 4 + (size_t) c->len)) break;
+    if (!read_all(fd, head, 5)) break;
+    uint32_t len = get_be32(head + 1);
+    if (len > out_cap) {
+      uint8_t* grown = realloc(out, len);
+      if (!grown) break;
+      out = grown;
+      out_cap = len;
+    }
+    if (!read_all(fd, out, len)) break;
+    c->ns[c->done] = (now() - start) * 1e9;
+    c->status[head[0]]++;
+
+    if (c->verbose && c->done == 0) {
+      printf("status %d, %u bytes:\n", head[0], len);
+      fwrite(out, 1, len, stdout);
+      printf("\n");
+    }
+  }
+  if (c->done < c->requests) {
+    fprintf(stderr, "okdclient: connection lost after %d requests\n",
+      c->done);
+  }
+
+  free(req);
+  free(out);
+  close(fd);
+  return NULL;
+}
+
+static int compare_u64(const void* a, const void* b) {
+  uint64_t x = *(const uint64_t*) a, y = *(const uint64_t*) b;
+  return (x > y) - (x < y);
+}
+
+static double percentile(const uint64_t* sorted, size_t n, double p) {
+  if (n == 0) return 0;
+  size_t i = (size_t) (p * (n - 1) + 0.5);
+  return sorted[i] / 1e3;
+}
+
+int main(int argc, char* argv[]) {
+  int conns = 4;
+  int requests = 10000;
+  int verbose = 0;
+
+  int first = 1;
+  for (; first < argc && argv[first][0] == '-'; first++) {
+    if (!strcmp(argv[first], "-c") && first + 1 < argc) {
+      conns = atoi(argv[++first]);
+    } else if (!strcmp(argv[first], "-n") && first + 1 < argc) {
+      requests = atoi(argv[++first]);
+    } else if (!strcmp(argv[first], "-v")) {
+      verbose = 1;
+    } else {
+      break;
+    }
+  }
+  if (argc - first < 1 || argc - first > 2 || conns < 1 || requests < 1) {
+    printf("usage: okdclient [-c connections] [-n requests] [-v] "
+      "socket [payload-file]\n");
+    return 1;
+  }
+
+  uint8_t* payload = NULL;
+  long len = 0;
+  if (argc - first == 2) {
+    FILE* f = fopen(argv[first + 1], "rb");
+    if (f && fseek(f, 0, SEEK_END) == 0 && (len = ftell(f)) >= 0) {
+      rewind(f);
+      payload = malloc(len ? len : 1);
+      if (payload && fread(payload, 1, len, f) != (size_t) len) {
+        free(payload);
+        payload = NULL;
+      }
+    }
+    if (f) fclose(f);
+    if (!payload) {
+      fprintf(stderr, "okdclient: can't read %s\n", argv[first + 1]);
+      return 1;
+    }
+  }
+
+  Conn* c = calloc(conns, sizeof(Conn));
+  uint64_t* ns = calloc((size_t) conns * requests, sizeof(uint64_t));
+  if (!c || !ns) {
+    free(payload);
+    free(c);
+    free(ns);
+    return 1;
+  }
+
+  double start = now();
+  for (int i = 0; i < conns; i++) {
+    c[i].path = argv[first];
+    c[i].payload = payload;
+    c[i].len = (uint32_t) len;
+    c[i].requests = requests;
+    c[i].verbose = verbose && i == 0;
+    c[i].ns = ns + (size_t) i * requests;
+    if (pthread_create(&c[i].thread, NULL, run_conn, &c[i]) != 0) {
+      c[i].requests = 0;
+      c[i].thread = 0;
+    }
+  }
+
+  // gather every connection's latencies at the front of ns
+  size_t n = 0;
+  uint64_t status[256] = { 0 };
+  for (int i = 0; i < conns; i++) {
+    if (c[i].requests) pthread_join(c[i].thread, NULL);
+    memmove(ns + n, c[i].ns, c[i].done * sizeof(uint64_t));
+    n += c[i].done;
+    for (int s = 0; s < 256; s++) status[s] += c[i].status[s];
+  }
+  double elapsed = now() - start;
+
+  qsort(ns, n, sizeof(uint64_t), compare_u64);
+  printf("requests: %zu of %llu over %d connections\n", n,
+    (unsigned long long) conns * requests, conns);
+  printf("status:");
+  for (int s = 0; s < 256; s++) {
+    if (status[s]) printf(" %d:%llu", s, (unsigned long long) status[s]);
+  }
+  printf("\n");
+  printf("latency (us): p50 %.1f, p99 %.1f, max %.1f\n",
+    percentile(ns, n, 0.5), percentile(ns, n, 0.99), percentile(ns, n, 1.0));
+  printf("throughput: %.0f requests/s\n", elapsed > 0 ? n / elapsed : 0.0);
+
+  int failed = n < (size_t) conns * requests;
+  free(payload);
+  free(c);
+  free(ns);
+  return failed;
+}
@@ -1,18 +1,29 @@
 #define OK_IMPLEMENTATION
-#include "../ok.h"
+#include "../ok_stream.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 // defining the buffers for the VM to use
 static uint8_t* ram;
 static uint8_t* program;
+static OkStream console; // memory-mapped console, see ok_stream.h
 
 uint8_t ok_mem_read(size_t address) {
+  if (address - OK_STREAM_BASE < OK_STREAM_SIZE) {
+    return ok_stream_read(&console, address - OK_STREAM_BASE);
+  }
   return ram[address];
 }
 
 void ok_mem_write(size_t address, uint8_t val) {
-  if (address == 0x00babe) putchar(val); // memory-mapped putchar
+  if (address - OK_STREAM_BASE < OK_STREAM_SIZE) {
+    ok_stream_write(&console, address - OK_STREAM_BASE, val);
+    return;
+  }
+  if (address == OK_STREAM_CONSOLE) {
+    ok_stream_write(&console, OK_STREAM_OUT, val); // stored in RAM as well
+  }
   ram[address] = val;
 }
 
@@ -48,10 +59,15 @@ int main(int argc, char* argv[]) {
   }
 
   printf("Starting VM...\n");
-  
+  fflush(stdout); // the console writes to the same fd, bypassing stdio
+
+  // line buffered on a terminal, so prompts show up as they're printed
+  ok_stream_init(&console, ram, STDIN_FILENO, STDOUT_FILENO,
+    isatty(STDOUT_FILENO));
   OkState vm;
   ok_init(&vm);
   while (vm.status == OK_RUNNING) ok_tick(&vm);
+  ok_stream_flush(&console);
 
   free(ram);
   free(program);
@@ -0,0 +1,52 @@
+#define OK_OPT_IMPLEMENTATION
+#include "../ok_opt.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(int argc, char* argv[]) {
+  if (argc != 3) {
+    printf("usage: okopt in.rom out.rom\n");
+    return 1;
+  }
+
+  uint8_t* rom = calloc(OK_MEM_SIZE, 1);
+  uint8_t* out = calloc(OK_MEM_SIZE, 1);
+  if (!rom || !out) {
+    free(rom);
+    free(out);
+    return 1;
+  }
+
+  FILE* f = fopen(argv[1], "rb");
+  if (!f) {
+    fprintf(stderr, "okopt: can't open %s\n", argv[1]);
+    free(rom);
+    free(out);
+    return 1;
+  }
+  size_t len = fread(rom, 1, OK_MEM_SIZE, f);
+  fclose(f);
+
+  OkOptStats stats;
+  size_t out_len = ok_opt(rom, len, out, &stats);
+  if (out_len == 0) {
+    // pass the ROM through untouched so builds keep working
+    fprintf(stderr, "okopt: not optimized: %s\n", stats.reason);
+    out_len = len;
+    for (size_t i = 0; i < len; i++) out[i] = rom[i];
+  } else {
+    fprintf(stderr, "okopt: %zu -> %zu bytes, %zu -> %zu instructions "
+      "(%zu folded, %zu threaded, %zu dead)\n", stats.in_bytes,
+      stats.out_bytes, stats.in_insns, stats.out_insns, stats.folded,
+      stats.threaded, stats.dead);
+  }
+
+  f = fopen(argv[2], "wb");
+  int failed = !f || fwrite(out, 1, out_len, f) != out_len;
+  if (f) failed |= fclose(f) != 0;
+  if (failed) fprintf(stderr, "okopt: can't write %s\n", argv[2]);
+
+  free(rom);
+  free(out);
+  return failed;
+}
@@ -8,8 +8,17 @@ typedef enum {
   OK_RUNNING, // currently executing
   OK_HALTED, // halted normally
   OK_PANIC, // halted abnormally
+  OK_OUT_OF_FUEL, // paused by a meter, see ok_run_metered
 } OkStatus;
 
+// opcodes, stored in the low nibble of an instruction byte
+typedef enum {
+  OK_ADD, OK_AND, OK_XOR, OK_SHF, OK_SWP, OK_CMP, OK_STR, OK_LOD,
+  OK_DUP, OK_DRP, OK_PSH, OK_POP, OK_JMP, OK_LIT, OK_FET, OK_NOP,
+} OkOpcode;
+
+typedef struct OkHooks OkHooks;
+
 typedef struct {
   uint8_t d; // data stack pointer
   uint8_t dst[256]; // circular data stack
@@ -17,6 +26,7 @@ typedef struct {
   uint8_t rst[256]; // circular return stack
   size_t pc; // program counter
   OkStatus status; // current VM status
+  const OkHooks* hooks; // called before every instruction, or NULL
 } OkState;
 
 // useful constants
@@ -35,19 +45,207 @@ void ok_init(OkState* s);
 // cycle the VM clock
 OkStatus ok_tick(OkState* s);
 
+// instruction hooks: work that has to happen before every instruction, like
+// charging fuel or keeping a clock for a heatmap or a replay log, registered
+// once on an OkHooks and picked up by every engine (ok_run, ok_code_run,
+// ok_tier_run, ...) through OkState.hooks. A hook is given the instruction
+// byte about to run, and setting s->status to anything but OK_RUNNING stops
+// the VM before that instruction. ok_tick never calls hooks, so a run loop
+// of your own should call ok_run(s, 1) instead.
+#ifndef OK_HOOKS_MAX
+#define OK_HOOKS_MAX (8) // most hooks on one OkHooks
+#endif
+
+typedef void (*OkHook)(void* ctx, OkState* s, uint8_t instr);
+
+struct OkHooks {
+  int n;
+  OkHook fn[OK_HOOKS_MAX];
+  void* ctx[OK_HOOKS_MAX];
+};
+
+// start an empty hook list
+void ok_hooks_init(OkHooks* h);
+
+// call fn(ctx, ...) before every instruction, after the hooks already added.
+// Returns 1 on success, 0 if there are OK_HOOKS_MAX already.
+int ok_hooks_add(OkHooks* h, OkHook fn, void* ctx);
+
+// run s for at most max instructions, or until it stops, calling its hooks.
+// Returns how many instructions ran.
+uint64_t ok_run(OkState* s, uint64_t max);
+
+// instruction metering: every instruction byte has a cost, and
+// ok_run_metered runs the VM until it halts or the next instruction would
+// cost more fuel than is left, stopping with OK_OUT_OF_FUEL right before
+// it. Straight-line runs of instructions (up to and including a `jmp` or a
+// halt) are charged at once when there is fuel for all of them, and their
+// costs are cached by start address, so call ok_meter_flush after changing
+// the ROM. Where the VM stops and what it is charged only depend on the
+// instructions executed, never on the caching. Any other engine is metered
+// by adding ok_meter_hook to its hooks, which charges the same one
+// instruction at a time.
+#ifndef OK_METER_RUNS
+#define OK_METER_RUNS (256) // cached runs, a power of two
+#endif
+#define OK_METER_MAX_RUN (64) // most instructions charged at once
+
+typedef struct {
+  size_t pc; // where the run starts, or SIZE_MAX if the slot is empty
+  uint32_t cost; // cost of every instruction in it
+  uint32_t len; // instructions in it
+} OkMeterRun;
+
+typedef struct {
+  uint64_t fuel; // fuel left
+  uint64_t used; // fuel charged so far
+  uint32_t cost[256]; // cost of each instruction byte
+  OkMeterRun runs[OK_METER_RUNS];
+} OkMeter;
+
+// set up a meter with fuel, charging 1 per instruction and nothing for halts
+void ok_meter_init(OkMeter* m, uint64_t fuel);
+
+// set the cost of an opcode at a width (1-4), with or without the skip flag
+void ok_meter_set_cost(OkMeter* m, OkOpcode op, uint8_t width, uint32_t cost);
+
+// add fuel, resuming the VM if it ran out
+void ok_meter_refuel(OkMeter* m, OkState* s, uint64_t fuel);
+
+// forget the cached runs
+void ok_meter_flush(OkMeter* m);
+
+// run the VM until it stops or runs out of fuel. Hooks the VM has are called
+// after each instruction is charged for.
+OkStatus ok_run_metered(OkState* s, OkMeter* m);
+
+// instruction hook charging for each instruction, with the OkMeter as ctx
+void ok_meter_hook(void* ctx, OkState* s, uint8_t instr);
+
 // some helper functions that the user may use for fetching big-endian
 // values from byte buffers (RAM or program memory)
 uint32_t ok_get_bytes(uint8_t* buffer, size_t index, uint8_t amt);
 void ok_set_bytes(uint8_t* buffer, size_t index, uint8_t amt, uint32_t val);
 
+// array versions of the above: convert count amt-wide values starting at
+// buffer[index] to or from host values (ok_set_array keeps the low amt bytes
+// of each). They use SSSE3 or AVX2 shuffles when compiled with them enabled.
+// Returns 1 on success, or 0 without touching anything if the values don't
+// fit in the len-byte buffer or amt isn't 1 to 4.
+int ok_get_array(const uint8_t* buffer, size_t len, size_t index, uint8_t amt,
+                 uint32_t* out, size_t count);
+int ok_set_array(uint8_t* buffer, size_t len, size_t index, uint8_t amt,
+                 const uint32_t* vals, size_t count);
+
 // this helper function opens a file at a path and loads it into a byte buffer
 // it loads the bytes from the file into the buffer, with the file's first byte
 // at buffer[start]. Returns nonzero upon failure.
 int ok_load_file(uint8_t* buffer, size_t start, const char* filepath);
 
+// arithmetic coprocessor: a memory-mapped device an emulator can expose to
+// guests by routing reads and writes of its register window to
+// ok_coproc_read and ok_coproc_write. Registers are big-endian:
+// - A, B (4 bytes each): operands; an operation uses their low width bytes
+// - OP (1 byte): writing it runs an operation right away, with the operation
+//   in the low nibble and the width in bits 4-5 like an instruction's `aa`
+// - STATUS (1 byte): 1 after dividing by zero, 0 otherwise
+// - LO, HI (4 bytes each): results, in their low width bytes. Multiplying
+//   leaves the low half of the product in LO and the high half in HI, and
+//   dividing leaves the quotient in LO and the remainder in HI
+#ifndef OK_COPROC_BASE
+#define OK_COPROC_BASE (0xffff00) // address of the register window
+#endif
+
+#define OK_COPROC_A (0)
+#define OK_COPROC_B (4)
+#define OK_COPROC_OP (8)
+#define OK_COPROC_STATUS (9)
+#define OK_COPROC_LO (10)
+#define OK_COPROC_HI (14)
+#define OK_COPROC_SIZE (18) // size of the register window
+
+#define OK_COPROC_MUL (1) // unsigned multiply
+#define OK_COPROC_MULS (2) // signed multiply (differs from MUL only in HI)
+#define OK_COPROC_DIV (3) // unsigned divide
+#define OK_COPROC_DIVS (4) // signed divide, rounding towards zero
+
+typedef struct {
+  uint8_t regs[OK_COPROC_SIZE];
+} OkCoproc;
+
+// register window accessors, offset is relative to OK_COPROC_BASE
+uint8_t ok_coproc_read(OkCoproc* cp, size_t offset);
+void ok_coproc_write(OkCoproc* cp, size_t offset, uint8_t val);
+
+// bulk memory engine: a memory-mapped device that copies, fills, compares
+// and searches whole ranges of RAM (and copies ROM into RAM) in one go,
+// working on the emulator's RAM and ROM buffers directly with libc's
+// memmove, memcpy, memset, memcmp and memchr, so it runs as fast as those
+// do on the host (there are no SIMD kernels here). Its writes bypass
+// ok_mem_write, so emulators tracking writes must account for them (e.g.
+// with ok_ckpt_mark_range). Registers are big-endian:
+// - SRC, DST, LEN (word each): source, destination, and length in bytes
+// - VAL (1 byte): byte to fill with, or to search for
+// - OP (1 byte): writing it runs an operation to completion
+// - STATUS (1 byte): 0 on success, 1 if a range fell outside memory or the
+//   operation is unknown
+// - RESULT (word): for compare, 0 if the ranges are equal, or 1 or 255 if
+//   SRC's bytes sort after or before DST's, like `cmp`; for search, the
+//   offset of the first match from SRC, or all ones if there is none
+#ifndef OK_DMA_BASE
+#define OK_DMA_BASE (0xffff20) // address of the register window
+#endif
+
+#define OK_DMA_SRC (0)
+#define OK_DMA_DST (OK_DMA_SRC + OK_WORD_SIZE)
+#define OK_DMA_LEN (OK_DMA_DST + OK_WORD_SIZE)
+#define OK_DMA_VAL (OK_DMA_LEN + OK_WORD_SIZE)
+#define OK_DMA_OP (OK_DMA_VAL + 1)
+#define OK_DMA_STATUS (OK_DMA_OP + 1)
+#define OK_DMA_RESULT (OK_DMA_STATUS + 1)
+#define OK_DMA_SIZE (OK_DMA_RESULT + OK_WORD_SIZE) // size of the window
+
+#define OK_DMA_COPY (1) // RAM[DST..] = RAM[SRC..], ranges may overlap
+#define OK_DMA_LOAD (2) // RAM[DST..] = ROM[SRC..]
+#define OK_DMA_FILL (3) // RAM[DST..] = VAL
+#define OK_DMA_CMP (4) // compare RAM[SRC..] with RAM[DST..]
+#define OK_DMA_FIND (5) // find VAL in RAM[SRC..]
+
+typedef struct {
+  uint8_t* ram; // OK_MEM_SIZE bytes
+  const uint8_t* rom; // OK_MEM_SIZE bytes
+  uint8_t regs[OK_DMA_SIZE];
+} OkDma;
+
+// register window accessors, offset is relative to OK_DMA_BASE
+uint8_t ok_dma_read(OkDma* dma, size_t offset);
+void ok_dma_write(OkDma* dma, size_t offset, uint8_t val);
+
 #ifdef OK_IMPLEMENTATION // VM implementation
 
 #include <stdio.h> // for ok_load_file
+#include <string.h> // for the bulk memory engine
+
+#if defined(__AVX2__)
+#include <immintrin.h> // for the array helpers
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
+// host-boundary accounting: with OK_ACCOUNTING defined, the VM calls the
+// emulator through the counting and timing wrappers in ok_acct.h
+#ifdef OK_ACCOUNTING
+uint8_t ok_acct_mem_read(size_t address);
+void ok_acct_mem_write(size_t address, uint8_t val);
+uint8_t ok_acct_fetch(size_t address);
+#define OK_MEM_READ ok_acct_mem_read
+#define OK_MEM_WRITE ok_acct_mem_write
+#define OK_FETCH ok_acct_fetch
+#else
+#define OK_MEM_READ ok_mem_read
+#define OK_MEM_WRITE ok_mem_write
+#define OK_FETCH ok_fetch
+#endif
 
 // helper functions for reading/writing values in buffers
 
@@ -70,6 +268,104 @@ void ok_set_bytes(uint8_t* buffer, size_t index, uint8_t amt, uint32_t val) {
   }
 }
 
+// the array helpers convert 4 values at a time (8 with AVX2) with one
+// shuffle. Gathering: byte k of host value j (little-endian) comes from byte
+// amt*j + amt-1-k of the buffer, or is zero past amt. Scattering is the
+// inverse, leaving the bytes past 4*amt unused.
+#if defined(__SSSE3__)
+static void ok_array_masks(uint8_t amt, uint8_t get[16], uint8_t set[16]) {
+  for (int i = 0; i < 16; i++) set[i] = 0x80;
+  for (int j = 0; j < 4; j++) {
+    for (int k = 0; k < 4; k++) {
+      get[4 * j + k] = k < amt ? amt * j + amt - 1 - k : 0x80;
+      if (k < amt) set[amt * j + amt - 1 - k] = 4 * j + k;
+    }
+  }
+}
+#endif
+
+static int ok_array_fits(size_t len, size_t index, uint8_t amt, size_t count) {
+  return amt >= 1 && amt <= 4 && index <= len && count <= (len - index) / amt;
+}
+
+int ok_get_array(const uint8_t* buffer, size_t len, size_t index, uint8_t amt,
+                 uint32_t* out, size_t count) {
+  if (!ok_array_fits(len, index, amt, count)) return 0;
+  const uint8_t* in = buffer + index;
+  size_t i = 0;
+
+#if defined(__SSSE3__)
+  uint8_t get[16], set[16];
+  ok_array_masks(amt, get, set);
+  __m128i mask = _mm_loadu_si128((const __m128i*) get);
+  size_t end = len - index; // bytes readable from in
+
+#if defined(__AVX2__)
+  __m256i mask2 = _mm256_broadcastsi128_si256(mask);
+  for (; i + 8 <= count && amt * i + 4 * amt + 16 <= end; i += 8) {
+    const uint8_t* at = in + amt * i;
+    __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(
+      _mm_loadu_si128((const __m128i*) at)),
+      _mm_loadu_si128((const __m128i*) (at + 4 * amt)), 1);
+    _mm256_storeu_si256((__m256i*) (out + i), _mm256_shuffle_epi8(v, mask2));
+  }
+#endif
+
+  for (; i + 4 <= count && amt * i + 16 <= end; i += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i*) (in + amt * i));
+    _mm_storeu_si128((__m128i*) (out + i), _mm_shuffle_epi8(v, mask));
+  }
+#endif
+
+  for (; i < count; i++) {
+    const uint8_t* at = in + amt * i;
+    uint32_t val = 0;
+    for (uint8_t k = 0; k < amt; k++) val = (val << 8) | at[k];
+    out[i] = val;
+  }
+  return 1;
+}
+
+int ok_set_array(uint8_t* buffer, size_t len, size_t index, uint8_t amt,
+                 const uint32_t* vals, size_t count) {
+  if (!ok_array_fits(len, index, amt, count)) return 0;
+  uint8_t* out = buffer + index;
+  size_t i = 0;
+
+#if defined(__SSSE3__)
+  uint8_t get[16], set[16];
+  ok_array_masks(amt, get, set);
+  __m128i mask = _mm_loadu_si128((const __m128i*) set);
+  uint8_t tmp[32];
+
+#if defined(__AVX2__)
+  __m256i mask2 = _mm256_broadcastsi128_si256(mask);
+  for (; i + 8 <= count; i += 8) {
+    __m256i v = _mm256_loadu_si256((const __m256i*) (vals + i));
+    _mm256_storeu_si256((__m256i*) tmp, _mm256_shuffle_epi8(v, mask2));
+    memcpy(out + amt * i, tmp, 4 * amt);
+    memcpy(out + amt * i + 4 * amt, tmp + 16, 4 * amt);
+  }
+#endif
+
+  for (; i + 4 <= count; i += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i*) (vals + i));
+    _mm_storeu_si128((__m128i*) tmp, _mm_shuffle_epi8(v, mask));
+    memcpy(out + amt * i, tmp, 4 * amt);
+  }
+#endif
+
+  for (; i < count; i++) {
+    uint8_t* at = out + amt * i;
+    uint32_t val = vals[i];
+    for (int k = amt - 1; k >= 0; k--) {
+      at[k] = (uint8_t) (val & 0xff);
+      val >>= 8;
+    }
+  }
+  return 1;
+}
+
 // helper function for loading a file at a path
 int ok_load_file(uint8_t* buffer, size_t start, const char* filepath) {
   FILE* f = fopen(filepath, "rb");
@@ -101,6 +397,122 @@ int ok_load_file(uint8_t* buffer, size_t start, const char* filepath) {
   return 1;
 }
 
+// coprocessor
+
+// sign-extend a width-byte value
+static int64_t ok_coproc_signed(uint32_t val, uint8_t width) {
+  uint8_t shift = 64 - 8 * width;
+  return (int64_t) ((uint64_t) val << shift) >> shift;
+}
+
+static void ok_coproc_run(OkCoproc* cp, uint8_t op) {
+  uint8_t width = ((op >> 4) & 3) + 1;
+  uint8_t bits = 8 * width;
+  uint64_t mask = ((uint64_t) 1 << bits) - 1;
+  uint32_t a = ok_get_bytes(cp->regs, OK_COPROC_A, 4) & mask;
+  uint32_t b = ok_get_bytes(cp->regs, OK_COPROC_B, 4) & mask;
+  uint64_t lo = 0, hi = 0;
+  uint8_t status = 0;
+
+  switch (op & 0x0f) {
+    case OK_COPROC_MUL:
+      lo = (uint64_t) a * b;
+      hi = lo >> bits;
+      break;
+    case OK_COPROC_MULS:
+      lo = (uint64_t) (ok_coproc_signed(a, width) * ok_coproc_signed(b, width));
+      hi = lo >> bits;
+      break;
+    case OK_COPROC_DIV:
+      if (b == 0) { // like RISC-V: all ones, and the dividend as remainder
+        status = 1;
+        lo = mask;
+        hi = a;
+      } else {
+        lo = a / b;
+        hi = a % b;
+      }
+      break;
+    case OK_COPROC_DIVS: {
+      int64_t sa = ok_coproc_signed(a, width), sb = ok_coproc_signed(b, width);
+      if (sb == 0) {
+        status = 1;
+        lo = mask;
+        hi = a;
+      } else {
+        // can't overflow in 64 bits; the most negative value over -1 just
+        // wraps back around to itself when truncated to width
+        lo = (uint64_t) (sa / sb);
+        hi = (uint64_t) (sa % sb);
+      }
+      break;
+    }
+  }
+
+  ok_set_bytes(cp->regs, OK_COPROC_LO, 4, (uint32_t) (lo & mask));
+  ok_set_bytes(cp->regs, OK_COPROC_HI, 4, (uint32_t) (hi & mask));
+  cp->regs[OK_COPROC_STATUS] = status;
+}
+
+uint8_t ok_coproc_read(OkCoproc* cp, size_t offset) {
+  return offset < OK_COPROC_SIZE ? cp->regs[offset] : 0;
+}
+
+void ok_coproc_write(OkCoproc* cp, size_t offset, uint8_t val) {
+  if (offset >= OK_COPROC_SIZE) return;
+  cp->regs[offset] = val;
+  if (offset == OK_COPROC_OP) ok_coproc_run(cp, val);
+}
+
+// bulk memory engine
+//
+// every operation is one libc call, and any vectorizing is libc's own, e.g.
+// glibc picking SSE2 or AVX2 versions for the host CPU at load time
+
+static void ok_dma_run(OkDma* dma, uint8_t op) {
+  size_t src = ok_get_bytes(dma->regs, OK_DMA_SRC, OK_WORD_SIZE);
+  size_t dst = ok_get_bytes(dma->regs, OK_DMA_DST, OK_WORD_SIZE);
+  size_t len = ok_get_bytes(dma->regs, OK_DMA_LEN, OK_WORD_SIZE);
+  uint8_t val = dma->regs[OK_DMA_VAL];
+  uint32_t result = 0;
+  uint8_t status = 0;
+
+  int uses_src = op != OK_DMA_FILL;
+  int uses_dst = op != OK_DMA_FIND;
+
+  if (op < OK_DMA_COPY || op > OK_DMA_FIND
+      || (uses_src && src + len > OK_MEM_SIZE)
+      || (uses_dst && dst + len > OK_MEM_SIZE)) {
+    status = 1;
+  } else if (op == OK_DMA_COPY) {
+    memmove(dma->ram + dst, dma->ram + src, len);
+  } else if (op == OK_DMA_LOAD) {
+    memcpy(dma->ram + dst, dma->rom + src, len);
+  } else if (op == OK_DMA_FILL) {
+    memset(dma->ram + dst, val, len);
+  } else if (op == OK_DMA_CMP) {
+    int c = memcmp(dma->ram + src, dma->ram + dst, len);
+    result = c > 0 ? 1 : (c < 0 ? 255 : 0);
+  } else {
+    const uint8_t* hit = (const uint8_t*) memchr(dma->ram + src, val, len);
+    result = hit ? (uint32_t) (hit - (dma->ram + src))
+      : (uint32_t) (((uint64_t) 1 << (8 * OK_WORD_SIZE)) - 1);
+  }
+
+  ok_set_bytes(dma->regs, OK_DMA_RESULT, OK_WORD_SIZE, result);
+  dma->regs[OK_DMA_STATUS] = status;
+}
+
+uint8_t ok_dma_read(OkDma* dma, size_t offset) {
+  return offset < OK_DMA_SIZE ? dma->regs[offset] : 0;
+}
+
+void ok_dma_write(OkDma* dma, size_t offset, uint8_t val) {
+  if (offset >= OK_DMA_SIZE) return;
+  dma->regs[offset] = val;
+  if (offset == OK_DMA_OP) ok_dma_run(dma, val);
+}
+
 // circular stack functions
 static inline void ok_dst_push(OkState* s, uint8_t n, uint32_t val) {
   for (int i = n - 1; i >= 0; i--) {
@@ -144,6 +556,7 @@ void ok_init(OkState* s) {
   s->r = 0;
   s->pc = 0;
   s->status = OK_RUNNING;
+  s->hooks = NULL;
   for (int i = 0; i < 256; i++) {
     s->dst[i] = 0;
     s->rst[i] = 0;
@@ -154,7 +567,134 @@ static void execute(OkState* s, uint8_t instr);
 
 // cycle the VM clock
 OkStatus ok_tick(OkState* s) {
-  execute(s, ok_fetch(s->pc++));
+  execute(s, OK_FETCH(s->pc++));
+  return s->status;
+}
+
+// instruction hooks
+
+void ok_hooks_init(OkHooks* h) {
+  h->n = 0;
+}
+
+int ok_hooks_add(OkHooks* h, OkHook fn, void* ctx) {
+  if (h->n == OK_HOOKS_MAX) return 0;
+  h->fn[h->n] = fn;
+  h->ctx[h->n] = ctx;
+  h->n++;
+  return 1;
+}
+
+// call s's hooks before instr; returns whether it may run
+static inline int ok_hooks_call(OkState* s, uint8_t instr) {
+  const OkHooks* h = s->hooks;
+  for (int i = 0; i < h->n; i++) h->fn[i](h->ctx[i], s, instr);
+  return s->status == OK_RUNNING;
+}
+
+// ok_tick with hooks; returns 0 if they stopped the VM before the instruction
+static inline int ok_hooked_tick(OkState* s) {
+  uint8_t instr = OK_FETCH(s->pc);
+  if (!ok_hooks_call(s, instr)) return 0;
+  s->pc++;
+  execute(s, instr);
+  return 1;
+}
+
+uint64_t ok_run(OkState* s, uint64_t max) {
+  uint64_t n = 0;
+  if (!s->hooks) {
+    // ok_tick, but spelled out so it's inlined into the loop
+    for (; s->status == OK_RUNNING && n < max; n++) {
+      execute(s, OK_FETCH(s->pc++));
+    }
+    return n;
+  }
+  while (s->status == OK_RUNNING && n < max && ok_hooked_tick(s)) n++;
+  return n;
+}
+
+// instruction metering
+
+void ok_meter_init(OkMeter* m, uint64_t fuel) {
+  m->fuel = fuel;
+  m->used = 0;
+  for (int i = 0; i < 256; i++) m->cost[i] = (i & 0x80) ? 1 : 0;
+  ok_meter_flush(m);
+}
+
+void ok_meter_set_cost(OkMeter* m, OkOpcode op, uint8_t width, uint32_t cost) {
+  uint8_t instr = 0x80 | ((width - 1) & 3) << 4 | (op & 0x0f);
+  m->cost[instr] = cost;
+  m->cost[instr | 0x40] = cost;
+  ok_meter_flush(m);
+}
+
+void ok_meter_refuel(OkMeter* m, OkState* s, uint64_t fuel) {
+  m->fuel += fuel;
+  if (s->status == OK_OUT_OF_FUEL) s->status = OK_RUNNING;
+}
+
+void ok_meter_flush(OkMeter* m) {
+  for (int i = 0; i < OK_METER_RUNS; i++) m->runs[i].pc = SIZE_MAX;
+}
+
+// charge for instr, or stop s before it if there isn't enough fuel
+static inline void ok_meter_charge(OkMeter* m, OkState* s, uint8_t instr) {
+  uint32_t cost = m->cost[instr];
+  if (cost > m->fuel) {
+    s->status = OK_OUT_OF_FUEL;
+    return;
+  }
+  m->fuel -= cost;
+  m->used += cost;
+}
+
+void ok_meter_hook(void* ctx, OkState* s, uint8_t instr) {
+  ok_meter_charge((OkMeter*) ctx, s, instr);
+}
+
+// find (or measure) the straight-line run starting at pc. Its bytes are
+// read with ok_fetch itself, as the lookahead isn't the guest fetching.
+static const OkMeterRun* ok_meter_run(OkMeter* m, size_t pc) {
+  OkMeterRun* run = &m->runs[pc & (OK_METER_RUNS - 1)];
+  if (run->pc == pc) return run;
+
+  run->pc = pc;
+  run->cost = 0;
+  run->len = 0;
+  while (run->len < OK_METER_MAX_RUN) {
+    uint8_t instr = ok_fetch(pc);
+    run->cost += m->cost[instr];
+    run->len++;
+    if ((instr & 0x80) == 0 || (instr & 0x0f) == OK_JMP) break;
+    pc += (instr & 0x0f) == OK_LIT ? 2 + ((instr >> 4) & 3) : 1;
+  }
+  return run;
+}
+
+OkStatus ok_run_metered(OkState* s, OkMeter* m) {
+  while (s->status == OK_RUNNING) {
+    const OkMeterRun* run = s->hooks ? NULL : ok_meter_run(m, s->pc);
+
+    if (run && run->cost <= m->fuel) {
+      // enough fuel for the whole run, so no checks in between
+      m->fuel -= run->cost;
+      m->used += run->cost;
+      for (uint32_t i = 0; i < run->len; i++) ok_tick(s);
+      continue;
+    }
+
+    // otherwise (or with hooks to call), go one instruction at a time
+    uint8_t instr = OK_FETCH(s->pc);
+    ok_meter_charge(m, s, instr);
+    if (s->status != OK_RUNNING || (s->hooks && !ok_hooks_call(s, instr))) {
+      break;
+    }
+    s->pc++;
+    execute(s, instr);
+  }
+
   return s->status;
 }
 
@@ -168,7 +708,7 @@ static void handle_opcode(OkState* vm, uint8_t opcode, uint8_t arg, uint8_t skip
   uint8_t byte;
 
   switch (opcode) {
-    case 0: // add
+    case OK_ADD:
       b = ok_dst_pop(vm, arg + 1);
       a = ok_dst_pop(vm, arg + 1);
       if (skip) {
@@ -182,7 +722,7 @@ static void handle_opcode(OkState* vm, uint8_t opcode, uint8_t arg, uint8_t skip
         ok_dst_push(vm, arg + 1, a + b);
       }
       break;
-    case 1: // and
+    case OK_AND:
       b = ok_dst_pop(vm, arg + 1);
       a = ok_dst_pop(vm, arg + 1);
       if (skip) {
@@ -196,7 +736,7 @@ static void handle_opcode(OkState* vm, uint8_t opcode, uint8_t arg, uint8_t skip
         ok_dst_push(vm, arg + 1, a & b);
       }
       break;
-    case 2: // xor
+    case OK_XOR:
       b = ok_dst_pop(vm, arg + 1);
       a = ok_dst_pop(vm, arg + 1);
       if (skip) {
@@ -210,7 +750,7 @@ static void handle_opcode(OkState* vm, uint8_t opcode, uint8_t arg, uint8_t skip
         ok_dst_push(vm, arg + 1, a ^ b);
       }
       break;
-    case 3: // shf
+    case OK_SHF:
       byte = (uint8_t) ok_dst_pop(vm, 1);
       n = ok_dst_pop(vm, arg + 1);
 
@@ -229,7 +769,7 @@ static void handle_opcode(OkState* vm, uint8_t opcode, uint8_t arg, uint8_t skip
         ok_dst_push(vm, arg + 1, n);
       }
       break;
-    case 4: // swp
+    case OK_SWP:
       b = ok_dst_pop(vm, arg + 1);
       a = ok_dst_pop(vm, arg + 1);
 
@@ -248,7 +788,7 @@ static void handle_opcode(OkState* vm, uint8_t opcode, uint8_t arg, uint8_t skip
         ok_dst_push(vm, arg + 1, a);
       }
       break;
-    case 5: // cmp
+    case OK_CMP:
       b = ok_dst_pop(vm, arg + 1);
       a = ok_dst_pop(vm, arg + 1);
 
@@ -275,39 +815,39 @@ static void handle_opcode(OkState* vm, uint8_t opcode, uint8_t arg, uint8_t skip
         }
       }
       break;
-    case 6: // str
+    case OK_STR:
       addr = (size_t) ok_dst_pop(vm, OK_WORD_SIZE);
       if (skip) {
         if (ok_dst_pop(vm, 1) != 0) {
           for (int i = arg; i >= 0; i--) {
-            ok_mem_write(addr + i, ok_dst_pop(vm, 1));
+            OK_MEM_WRITE(addr + i, ok_dst_pop(vm, 1));
           }
         } else { // restore
           ok_dst_push(vm, OK_WORD_SIZE, addr);
         }
       } else {
         for (int i = arg; i >= 0; i--) {
-          ok_mem_write(addr + i, ok_dst_pop(vm, 1)); 
+          OK_MEM_WRITE(addr + i, ok_dst_pop(vm, 1)); 
         }
       }
       break;
-    case 7: // lod
+    case OK_LOD:
       addr = (size_t) ok_dst_pop(vm, OK_WORD_SIZE);
       if (skip) {
         if (ok_dst_pop(vm, 1) != 0) {
           for (int i = 0; i < arg + 1; i++) {
-            ok_dst_push(vm, 1, ok_mem_read(addr + i));
+            ok_dst_push(vm, 1, OK_MEM_READ(addr + i));
           }
         } else { // restore
           ok_dst_push(vm, OK_WORD_SIZE, addr);
         }
       } else {
         for (int i = 0; i < arg + 1; i++) {
-          ok_dst_push(vm, 1, ok_mem_read(addr + i));
+          ok_dst_push(vm, 1, OK_MEM_READ(addr + i));
         }
       }
       break;
-    case 8: // dup
+    case OK_DUP:
       n = ok_dst_pop(vm, arg + 1);
 
       if (skip) {
@@ -322,7 +862,7 @@ static void handle_opcode(OkState* vm, uint8_t opcode, uint8_t arg, uint8_t skip
         ok_dst_push(vm, arg + 1, n);
       }
       break;
-    case 9: // drp (pop from stack)
+    case OK_DRP: // pop from stack
       n = ok_dst_pop(vm, arg + 1);
 
       if (skip) {
@@ -331,7 +871,7 @@ static void handle_opcode(OkState* vm, uint8_t opcode, uint8_t arg, uint8_t skip
         } // this one's a lot simpler
       }
       break;
-    case 10: // psh (push onto return stack)
+    case OK_PSH: // push onto return stack
       n = ok_dst_pop(vm, arg + 1);
 
       if (skip) {
@@ -344,7 +884,7 @@ static void handle_opcode(OkState* vm, uint8_t opcode, uint8_t arg, uint8_t skip
         ok_rst_push(vm, arg + 1, n);
       }
       break;
-    case 11: // pop (off of return stack)
+    case OK_POP: // pop off of return stack
       n = ok_rst_pop(vm, arg + 1);
 
       if (skip) {
@@ -357,7 +897,7 @@ static void handle_opcode(OkState* vm, uint8_t opcode, uint8_t arg, uint8_t skip
         ok_dst_push(vm, arg + 1, n);
       }
       break;
-    case 12: // jmp
+    case OK_JMP:
       addr = (size_t) ok_dst_pop(vm, arg + 1);
       if (skip) {
         if (ok_dst_pop(vm, 1) != 0) {
@@ -369,11 +909,11 @@ static void handle_opcode(OkState* vm, uint8_t opcode, uint8_t arg, uint8_t skip
         vm->pc = addr;
       }
       break;
-    case 13: // lit
+    case OK_LIT:
       if (skip) {
         if (ok_dst_pop(vm, 1) != 0) {
           for (int i = 0; i < arg + 1; i++) {
-            ok_dst_push(vm, 1, ok_fetch(vm->pc++));
+            ok_dst_push(vm, 1, OK_FETCH(vm->pc++));
           }
         } else {
           // we gotta skip the args in the ROM as well
@@ -381,27 +921,27 @@ static void handle_opcode(OkState* vm, uint8_t opcode, uint8_t arg, uint8_t skip
         }
       } else {
         for (int i = 0; i < arg + 1; i++) {
-          ok_dst_push(vm, 1, ok_fetch(vm->pc++));
+          ok_dst_push(vm, 1, OK_FETCH(vm->pc++));
         }
       }
       break;
-    case 14: // fet
+    case OK_FET:
       addr = (size_t) ok_dst_pop(vm, OK_WORD_SIZE);
       if (skip) {
         if (ok_dst_pop(vm, 1) != 0) {
           for (int i = 0; i < arg + 1; i++) {
-            ok_dst_push(vm, 1, ok_fetch(addr + i));
+            ok_dst_push(vm, 1, OK_FETCH(addr + i));
           }
         } else { // restore
           ok_dst_push(vm, OK_WORD_SIZE, addr);
         }
       } else {
         for (int i = 0; i < arg + 1; i++) {
-          ok_dst_push(vm, 1, ok_fetch(addr + i));
+          ok_dst_push(vm, 1, OK_FETCH(addr + i));
         }
       }
       break;
-    case 15: // nop
+    case OK_NOP:
       if (skip) {
         // even tho it's meaningless, skip flag here can still pop a flag byte
         ok_dst_pop(vm, 1);
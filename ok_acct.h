@@ -0,0 +1,268 @@
+#ifndef OK_ACCT_H
+#define OK_ACCT_H
+
+#include "ok.h"
+#include <stdio.h>
+
+// host-boundary cost accounting
+//
+// Every instruction fetch and every RAM access is a call into the emulator,
+// so time spent in ok_mem_read, ok_mem_write and ok_fetch is part of what a
+// guest costs. Compiling the VM (the translation unit defining
+// OK_IMPLEMENTATION) with OK_ACCOUNTING defined routes those calls through
+// the wrappers here, which count every call and time every
+// OkAcct.sample-th one with the CPU's timestamp counter (or the monotonic
+// clock where there is none), keeping a log2 histogram of the times taken.
+// Each counter counts down to its own samples, starting with its first
+// call, so a guest loop can't fall into step with the sampling and leave a
+// range that gets calls without any timings.
+//
+// Calls are split by where they go: fetches are one bucket, and reads and
+// writes are split by the address ranges set up with ok_acct_range (RAM,
+// MMIO windows, ...), first match first, with everything else in "other".
+// Bracketing a run (under any engine) with ok_acct_start and ok_acct_stop
+// times it too, so the report can show the share of it spent in the
+// emulator next to what's left for the interpreter.
+//
+// Sampled times are scaled up by calls / sampled calls, and the timer's own
+// overhead, measured at ok_acct_init, is taken off each of them.
+
+#ifndef OK_ACCT_RANGES
+#define OK_ACCT_RANGES (8) // most address ranges
+#endif
+
+#define OK_ACCT_BUCKETS (32) // histogram: 0, then [2^(b-1), 2^b) ticks
+
+typedef struct {
+  uint64_t calls;
+  uint64_t sampled; // calls timed
+  uint64_t ticks; // time taken by the timed calls
+  uint64_t hist[OK_ACCT_BUCKETS]; // timed calls by time taken
+  uint32_t countdown; // calls until the next timed one
+} OkAcctCounter;
+
+typedef struct {
+  const char* name;
+  size_t lo, hi; // addresses [lo, hi)
+  OkAcctCounter read;
+  OkAcctCounter write;
+} OkAcctRange;
+
+typedef struct {
+  OkAcctRange ranges[OK_ACCT_RANGES + 1]; // the last one in use is "other"
+  int nranges;
+  OkAcctCounter fetch;
+  uint32_t sample; // calls between timed ones, at least 1
+  uint64_t overhead; // ticks a timing itself takes
+  uint64_t run_ticks; // time between ok_acct_start and ok_acct_stop
+  uint64_t instructions; // instructions run in that time
+  uint64_t start; // timestamp at ok_acct_start
+  uint64_t tsc0, ns0; // for converting ticks to nanoseconds
+} OkAcct;
+
+// the accounts, global like the callbacks are
+extern OkAcct ok_acct;
+
+// start accounting from scratch, timing every sample-th call. Call it
+// before anything else here.
+void ok_acct_init(uint32_t sample);
+
+// account reads and writes of [lo, hi) under name. Returns 1 on success, 0
+// if there are OK_ACCT_RANGES already.
+int ok_acct_range(const char* name, size_t lo, size_t hi);
+
+// time a run, from ok_acct_start to ok_acct_stop, given the instructions
+// that ran in between
+void ok_acct_start(void);
+void ok_acct_stop(uint64_t instructions);
+
+// print calls, time and histograms per range and callback, next to the
+// interpreter's time in the timed runs. Returns 1 on success, 0 on failure.
+int ok_acct_write_report(FILE* f);
+
+#ifdef OK_IMPLEMENTATION
+
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+OkAcct ok_acct;
+
+static uint64_t ok_acct_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+static inline uint64_t ok_acct_now(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return ok_acct_ns();
+#endif
+}
+
+void ok_acct_init(uint32_t sample) {
+  memset(&ok_acct, 0, sizeof(ok_acct));
+  ok_acct.ranges[0].name = "other";
+  ok_acct.ranges[0].lo = ok_acct.ranges[0].hi = 0;
+  ok_acct.sample = sample ? sample : 1;
+
+  // the cheapest of a few back-to-back timings is the timer's overhead
+  ok_acct.overhead = UINT64_MAX;
+  for (int i = 0; i < 64; i++) {
+    uint64_t t0 = ok_acct_now(), t1 = ok_acct_now();
+    if (t1 - t0 < ok_acct.overhead) ok_acct.overhead = t1 - t0;
+  }
+  ok_acct.tsc0 = ok_acct_now();
+  ok_acct.ns0 = ok_acct_ns();
+}
+
+int ok_acct_range(const char* name, size_t lo, size_t hi) {
+  if (ok_acct.nranges == OK_ACCT_RANGES) return 0;
+
+  // "other" moves up to stay last
+  OkAcctRange* r = &ok_acct.ranges[ok_acct.nranges++];
+  ok_acct.ranges[ok_acct.nranges] = *r;
+  memset(r, 0, sizeof(*r));
+  r->name = name;
+  r->lo = lo;
+  r->hi = hi;
+  return 1;
+}
+
+static inline OkAcctRange* ok_acct_find(size_t address) {
+  OkAcctRange* r = ok_acct.ranges;
+  OkAcctRange* other = &ok_acct.ranges[ok_acct.nranges];
+  while (r < other && (address < r->lo || address >= r->hi)) r++;
+  return r;
+}
+
+// whether to time this call
+static inline int ok_acct_due(OkAcctCounter* c) {
+  c->calls++;
+  if (c->countdown > 0) {
+    c->countdown--;
+    return 0;
+  }
+  c->countdown = ok_acct.sample - 1;
+  return 1;
+}
+
+static void ok_acct_record(OkAcctCounter* c, uint64_t t0, uint64_t t1) {
+  uint64_t ticks = t1 - t0;
+  ticks = ticks > ok_acct.overhead ? ticks - ok_acct.overhead : 0;
+  int bucket = 0;
+  while (bucket < OK_ACCT_BUCKETS - 1 && ticks >> bucket) bucket++;
+  c->sampled++;
+  c->ticks += ticks;
+  c->hist[bucket]++;
+}
+
+uint8_t ok_acct_mem_read(size_t address) {
+  OkAcctCounter* c = &ok_acct_find(address)->read;
+  if (!ok_acct_due(c)) return ok_mem_read(address);
+  uint64_t t0 = ok_acct_now();
+  uint8_t val = ok_mem_read(address);
+  ok_acct_record(c, t0, ok_acct_now());
+  return val;
+}
+
+void ok_acct_mem_write(size_t address, uint8_t val) {
+  OkAcctCounter* c = &ok_acct_find(address)->write;
+  if (!ok_acct_due(c)) {
+    ok_mem_write(address, val);
+    return;
+  }
+  uint64_t t0 = ok_acct_now();
+  ok_mem_write(address, val);
+  ok_acct_record(c, t0, ok_acct_now());
+}
+
+uint8_t ok_acct_fetch(size_t address) {
+  OkAcctCounter* c = &ok_acct.fetch;
+  if (!ok_acct_due(c)) return ok_fetch(address);
+  uint64_t t0 = ok_acct_now();
+  uint8_t val = ok_fetch(address);
+  ok_acct_record(c, t0, ok_acct_now());
+  return val;
+}
+
+void ok_acct_start(void) {
+  ok_acct.start = ok_acct_now();
+}
+
+void ok_acct_stop(uint64_t instructions) {
+  ok_acct.run_ticks += ok_acct_now() - ok_acct.start;
+  ok_acct.instructions += instructions;
+}
+
+// estimated total ticks of all calls, from the timed ones
+static double ok_acct_total(const OkAcctCounter* c) {
+  return c->sampled ? (double) c->ticks * c->calls / c->sampled : 0.0;
+}
+
+static void ok_acct_write_counter(FILE* f, const char* name, const char* kind,
+                                  const OkAcctCounter* c, double ns_per_tick) {
+  if (c->calls == 0) return;
+  double total = ok_acct_total(c) * ns_per_tick;
+  double run = ok_acct.run_ticks * ns_per_tick;
+  fprintf(f, "%-12s %-6s %12llu %14.0f %6.1f%% %8.1f\n", name, kind,
+    (unsigned long long) c->calls, total, run > 0 ? 100 * total / run : 0.0,
+    c->sampled ? total / c->calls : 0.0);
+}
+
+static void ok_acct_write_hist(FILE* f, const char* name, const char* kind,
+                               const OkAcctCounter* c) {
+  if (c->sampled == 0) return;
+  fprintf(f, "%s %s:", name, kind);
+  for (int b = 0; b < OK_ACCT_BUCKETS; b++) {
+    if (c->hist[b] == 0) continue;
+    fprintf(f, " %llu:%llu", b ? 1ull << (b - 1) : 0,
+      (unsigned long long) c->hist[b]);
+  }
+  fputc('\n', f);
+}
+
+int ok_acct_write_report(FILE* f) {
+  uint64_t ticks = ok_acct_now() - ok_acct.tsc0;
+  uint64_t ns = ok_acct_ns() - ok_acct.ns0;
+  double ns_per_tick = ticks ? (double) ns / ticks : 1.0;
+
+  fprintf(f, "%-12s %-6s %12s %14s %7s %8s\n", "range", "call", "calls",
+    "est-ns", "of-run", "ns/call");
+  ok_acct_write_counter(f, "rom", "fetch", &ok_acct.fetch, ns_per_tick);
+  double callbacks = ok_acct_total(&ok_acct.fetch);
+  for (int i = 0; i <= ok_acct.nranges; i++) {
+    const OkAcctRange* r = &ok_acct.ranges[i];
+    ok_acct_write_counter(f, r->name, "read", &r->read, ns_per_tick);
+    ok_acct_write_counter(f, r->name, "write", &r->write, ns_per_tick);
+    callbacks += ok_acct_total(&r->read) + ok_acct_total(&r->write);
+  }
+
+  double run = ok_acct.run_ticks * ns_per_tick;
+  double interp = run - callbacks * ns_per_tick;
+  fprintf(f, "\nrun: %llu instructions, %.0f ns\n",
+    (unsigned long long) ok_acct.instructions, run);
+  fprintf(f, "callbacks: %.0f ns (%.1f%%)\n", run - interp,
+    run > 0 ? 100 * (run - interp) / run : 0.0);
+  fprintf(f, "interpreter: %.0f ns (%.2f ns/instruction)\n",
+    interp > 0 ? interp : 0.0,
+    ok_acct.instructions && interp > 0 ? interp / ok_acct.instructions : 0.0);
+
+  fprintf(f, "\nlatency histograms (ticks:timed calls):\n");
+  ok_acct_write_hist(f, "rom", "fetch", &ok_acct.fetch);
+  for (int i = 0; i <= ok_acct.nranges; i++) {
+    const OkAcctRange* r = &ok_acct.ranges[i];
+    ok_acct_write_hist(f, r->name, "read", &r->read);
+    ok_acct_write_hist(f, r->name, "write", &r->write);
+  }
+  return !ferror(f);
+}
+
+#endif // OK_IMPLEMENTATION
+
+#endif // OK_ACCT_H
@@ -0,0 +1,225 @@
+#ifndef OK_CHAN_H
+#define OK_CHAN_H
+
+#include "ok.h"
+#include <pthread.h>
+
+// message channels between VM instances
+//
+// An OkChan is a bounded single-producer, single-consumer ring buffer that
+// two VMs, usually on different host threads, share through an endpoint
+// each. An emulator maps an endpoint into its VM's address space by routing
+// accesses to [base, base + ok_chan_window(chan)) to ok_chan_read and
+// ok_chan_write, so guests read and write the ring directly; nothing is
+// copied on the way, and neither side takes a lock unless it has to sleep.
+//
+// Register window (offsets from the endpoint's base), words are big-endian:
+// - OFFSET (word, read): where in DATA the producer writes its next byte, or
+//   the consumer reads its next one
+// - AVAIL (word, read): bytes the producer has room for, or the consumer has
+//   waiting
+// - COMMIT (word, write): hands n bytes over to the other side, after the
+//   producer has written them or the consumer is done with them
+// - WAIT (word, write): sleeps until AVAIL is at least n, or the other side
+//   has closed the channel
+// - STATUS (1 byte): reads 1 once the other side has closed the channel, 0
+//   before. Writing closes it from this side, waking anyone waiting
+// - DATA: the ring, mapped twice in a row, so a run of up to the channel's
+//   capacity starting at OFFSET never has to wrap around
+//
+// Word registers are read as of their first (lowest) byte, and act when
+// their first byte is written, which is the last one `str` writes.
+//
+// Memory model: the bytes a producer writes before a COMMIT are visible to
+// the consumer once it sees them in AVAIL. A WAIT that has to sleep is woken
+// by the other side's next COMMIT or close, which only takes a lock when
+// somebody is asleep.
+
+// register offsets
+#define OK_CHAN_OFFSET (0)
+#define OK_CHAN_AVAIL (OK_CHAN_OFFSET + OK_WORD_SIZE)
+#define OK_CHAN_COMMIT (OK_CHAN_AVAIL + OK_WORD_SIZE)
+#define OK_CHAN_WAIT (OK_CHAN_COMMIT + OK_WORD_SIZE)
+#define OK_CHAN_STATUS (OK_CHAN_WAIT + OK_WORD_SIZE)
+#define OK_CHAN_DATA (16) // start of the ring
+
+#define OK_CHAN_SPIN (1000) // polls before a WAIT goes to sleep
+
+typedef struct {
+  uint8_t* data;
+  size_t cap; // ring size in bytes, a power of two
+  size_t head __attribute__((aligned(64))); // bytes ever committed
+  size_t tail __attribute__((aligned(64))); // bytes ever consumed
+  int closed __attribute__((aligned(64))); // bit 0: producer, bit 1: consumer
+  int sleepers; // threads asleep in WAIT
+  pthread_mutex_t lock;
+  pthread_cond_t bell;
+} OkChan;
+
+typedef struct {
+  OkChan* chan;
+  int producer; // 1 for the producer's end, 0 for the consumer's
+  size_t base; // where the emulator maps the window
+  uint8_t regs[OK_CHAN_DATA];
+} OkChanEnd;
+
+// set up a channel holding cap bytes, a power of two. Returns 1 on success,
+// 0 on failure.
+int ok_chan_init(OkChan* c, size_t cap);
+
+// release a channel nobody is using anymore
+void ok_chan_destroy(OkChan* c);
+
+// set up one end of c, to be mapped at base
+void ok_chan_end(OkChanEnd* e, OkChan* c, int producer, size_t base);
+
+// size of an endpoint's register window
+static inline size_t ok_chan_window(const OkChan* c) {
+  return OK_CHAN_DATA + 2 * c->cap;
+}
+
+// register window accessors, offset is relative to the endpoint's base
+uint8_t ok_chan_read(OkChanEnd* e, size_t offset);
+void ok_chan_write(OkChanEnd* e, size_t offset, uint8_t val);
+
+#ifdef OK_IMPLEMENTATION
+
+#include <sched.h>
+#include <stdlib.h>
+
+// indices are free-running, and so is AVAIL's view of them
+#define OK_CHAN_MASK ((size_t) (0xffffffffu >> (8 * (4 - OK_WORD_SIZE))))
+
+int ok_chan_init(OkChan* c, size_t cap) {
+  if (cap == 0 || (cap & (cap - 1)) != 0 || cap > OK_CHAN_MASK) return 0;
+  c->data = calloc(cap, 1);
+  if (!c->data) return 0;
+  c->cap = cap;
+  c->head = 0;
+  c->tail = 0;
+  c->closed = 0;
+  c->sleepers = 0;
+  if (pthread_mutex_init(&c->lock, NULL) != 0) {
+    free(c->data);
+    return 0;
+  }
+  if (pthread_cond_init(&c->bell, NULL) != 0) {
+    pthread_mutex_destroy(&c->lock);
+    free(c->data);
+    return 0;
+  }
+  return 1;
+}
+
+void ok_chan_destroy(OkChan* c) {
+  pthread_cond_destroy(&c->bell);
+  pthread_mutex_destroy(&c->lock);
+  free(c->data);
+  c->data = NULL;
+}
+
+void ok_chan_end(OkChanEnd* e, OkChan* c, int producer, size_t base) {
+  e->chan = c;
+  e->producer = producer;
+  e->base = base;
+  for (int i = 0; i < OK_CHAN_DATA; i++) e->regs[i] = 0;
+}
+
+// seq_cst so the check after registering as a sleeper can't miss a commit
+static size_t ok_chan_avail(const OkChanEnd* e) {
+  OkChan* c = e->chan;
+  size_t head = __atomic_load_n(&c->head, __ATOMIC_SEQ_CST);
+  size_t tail = __atomic_load_n(&c->tail, __ATOMIC_SEQ_CST);
+  return e->producer ? c->cap - (head - tail) : head - tail;
+}
+
+static int ok_chan_peer_closed(const OkChanEnd* e) {
+  int closed = __atomic_load_n(&e->chan->closed, __ATOMIC_SEQ_CST);
+  return (closed >> (e->producer ? 1 : 0)) & 1;
+}
+
+// wake the other side if it's asleep; the seq_cst accesses pair with the
+// ones in ok_chan_wait, so either it sees our update or we see it sleeping
+static void ok_chan_ring(OkChan* c) {
+  if (__atomic_load_n(&c->sleepers, __ATOMIC_SEQ_CST) == 0) return;
+  pthread_mutex_lock(&c->lock);
+  pthread_cond_broadcast(&c->bell);
+  pthread_mutex_unlock(&c->lock);
+}
+
+static void ok_chan_wait(OkChanEnd* e, size_t want) {
+  OkChan* c = e->chan;
+  if (want > c->cap) want = c->cap;
+
+  for (int i = 0; i < OK_CHAN_SPIN; i++) {
+    if (ok_chan_avail(e) >= want || ok_chan_peer_closed(e)) return;
+    if (i % 64 == 63) sched_yield();
+  }
+
+  pthread_mutex_lock(&c->lock);
+  __atomic_add_fetch(&c->sleepers, 1, __ATOMIC_SEQ_CST);
+  while (ok_chan_avail(e) < want && !ok_chan_peer_closed(e)) {
+    pthread_cond_wait(&c->bell, &c->lock);
+  }
+  __atomic_sub_fetch(&c->sleepers, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&c->lock);
+}
+
+static void ok_chan_commit(OkChanEnd* e, size_t n) {
+  OkChan* c = e->chan;
+  size_t avail = ok_chan_avail(e);
+  if (n > avail) n = avail;
+  if (n == 0) return;
+  if (e->producer) __atomic_add_fetch(&c->head, n, __ATOMIC_SEQ_CST);
+  else __atomic_add_fetch(&c->tail, n, __ATOMIC_SEQ_CST);
+  ok_chan_ring(c);
+}
+
+uint8_t ok_chan_read(OkChanEnd* e, size_t offset) {
+  OkChan* c = e->chan;
+  if (offset >= OK_CHAN_DATA) {
+    return c->data[(offset - OK_CHAN_DATA) & (c->cap - 1)];
+  }
+
+  switch (offset) {
+    case OK_CHAN_OFFSET: {
+      size_t at = e->producer ? c->head : c->tail; // only we change it
+      ok_set_bytes(e->regs, OK_CHAN_OFFSET, OK_WORD_SIZE,
+        (uint32_t) (at & (c->cap - 1)));
+      break;
+    }
+    case OK_CHAN_AVAIL:
+      ok_set_bytes(e->regs, OK_CHAN_AVAIL, OK_WORD_SIZE,
+        (uint32_t) ok_chan_avail(e));
+      break;
+    case OK_CHAN_STATUS:
+      return (uint8_t) ok_chan_peer_closed(e);
+  }
+  return e->regs[offset];
+}
+
+void ok_chan_write(OkChanEnd* e, size_t offset, uint8_t val) {
+  OkChan* c = e->chan;
+  if (offset >= OK_CHAN_DATA) {
+    c->data[(offset - OK_CHAN_DATA) & (c->cap - 1)] = val;
+    return;
+  }
+
+  e->regs[offset] = val;
+  switch (offset) {
+    case OK_CHAN_COMMIT:
+      ok_chan_commit(e, ok_get_bytes(e->regs, OK_CHAN_COMMIT, OK_WORD_SIZE));
+      break;
+    case OK_CHAN_WAIT:
+      ok_chan_wait(e, ok_get_bytes(e->regs, OK_CHAN_WAIT, OK_WORD_SIZE));
+      break;
+    case OK_CHAN_STATUS:
+      __atomic_or_fetch(&c->closed, e->producer ? 1 : 2, __ATOMIC_SEQ_CST);
+      ok_chan_ring(c);
+      break;
+  }
+}
+
+#endif // OK_IMPLEMENTATION
+
+#endif // OK_CHAN_H
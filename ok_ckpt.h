@@ -0,0 +1,270 @@
+#ifndef OK_CKPT_H
+#define OK_CKPT_H
+
+#include "ok.h"
+#include <stdio.h>
+
+// incremental checkpoints of VM state
+//
+// RAM is split into OK_CKPT_PAGE-byte pages, and every write that goes
+// through ok_ckpt_write (or is reported with ok_ckpt_mark) marks its page
+// dirty. A checkpoint appends the dirty pages and the OkState to a log file
+// and cleans every page, so its cost follows the guest's write rate rather
+// than the size of RAM. The first checkpoint after ok_ckpt_open is a full
+// one, holding every nonzero page.
+//
+// Restoring replays the log from the start, up to the first record that is
+// torn (e.g. from crashing mid-checkpoint) or fails its checksum. Opening the
+// log again cuts that record and everything after it off before appending,
+// so new records are never stranded behind a bad one. A file that doesn't
+// start with a good record isn't taken for a log, and is left alone.
+
+#ifndef OK_CKPT_PAGE
+#define OK_CKPT_PAGE (4096) // page size in bytes, a power of two
+#endif
+
+#define OK_CKPT_PAGES (OK_MEM_SIZE / OK_CKPT_PAGE)
+
+typedef struct {
+  uint8_t* ram; // OK_MEM_SIZE bytes
+  FILE* log;
+  uint64_t dirty[(OK_CKPT_PAGES + 63) / 64]; // pages written since last save
+  int full; // next checkpoint is a full one
+  uint32_t seq; // checkpoints saved since opening
+} OkCheckpoint;
+
+// start checkpointing ram into the log at path, appending if it exists.
+// Returns 1 on success, 0 on failure, including when path is a file that
+// isn't a log.
+int ok_ckpt_open(OkCheckpoint* c, uint8_t* ram, const char* path);
+
+// close the log
+void ok_ckpt_close(OkCheckpoint* c);
+
+// mark a byte, or a range of bytes, of RAM as written
+static inline void ok_ckpt_mark(OkCheckpoint* c, size_t address) {
+  size_t page = (address & (OK_MEM_SIZE - 1)) / OK_CKPT_PAGE;
+  c->dirty[page / 64] |= (uint64_t) 1 << (page % 64);
+}
+void ok_ckpt_mark_range(OkCheckpoint* c, size_t address, size_t len);
+
+// write path for ok_mem_write: store val in RAM and mark its page
+static inline void ok_ckpt_write(OkCheckpoint* c, size_t address, uint8_t val) {
+  c->ram[address] = val;
+  ok_ckpt_mark(c, address);
+}
+
+// append the dirty pages and s to the log. Returns 1 on success, 0 on failure.
+int ok_ckpt_save(OkCheckpoint* c, const OkState* s);
+
+// forget which pages are dirty, e.g. right after restoring the same log, so
+// the next checkpoint is a delta
+void ok_ckpt_clean(OkCheckpoint* c);
+
+// rebuild ram and s from the log at path. Returns the number of checkpoints
+// replayed, or 0 if there were none (or the file can't be read).
+uint32_t ok_ckpt_restore(const char* path, uint8_t* ram, OkState* s);
+
+#ifdef OK_IMPLEMENTATION
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h> // for truncate
+
+#define OK_CKPT_MAGIC (0x4f4b434b) // "OKCK"
+#define OK_CKPT_FULL (1) // record flag: pages not in the record are zero
+
+// serialized OkState: d, dst, r, rst, pc (8 bytes), status
+#define OK_CKPT_STATE (1 + 256 + 1 + 256 + 8 + 1)
+
+// record header: magic, flags, page count, body length (4 bytes each)
+#define OK_CKPT_HEADER (16)
+
+// FNV-1a, checksums each record
+static uint32_t ok_ckpt_hash(const uint8_t* buf, size_t len) {
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; i++) h = (h ^ buf[i]) * 16777619u;
+  return h;
+}
+
+// read the next record, header to checksum, into a buffer to free. Returns
+// NULL at the end of the log or at a record that is torn or corrupt.
+static uint8_t* ok_ckpt_read_record(FILE* f) {
+  uint8_t header[OK_CKPT_HEADER];
+  if (fread(header, 1, OK_CKPT_HEADER, f) != OK_CKPT_HEADER) return NULL;
+  uint32_t npages = ok_get_bytes(header, 8, 4);
+  size_t body = ok_get_bytes(header, 12, 4);
+  if (ok_get_bytes(header, 0, 4) != OK_CKPT_MAGIC || npages > OK_CKPT_PAGES
+      || body != OK_CKPT_STATE + (size_t) npages * (4 + OK_CKPT_PAGE)) {
+    return NULL;
+  }
+
+  uint8_t* rec = malloc(OK_CKPT_HEADER + body + 4);
+  if (!rec) return NULL;
+  memcpy(rec, header, OK_CKPT_HEADER);
+  if (fread(rec + OK_CKPT_HEADER, 1, body + 4, f) != body + 4
+      || ok_get_bytes(rec, OK_CKPT_HEADER + body, 4)
+        != ok_ckpt_hash(rec, OK_CKPT_HEADER + body)) {
+    free(rec);
+    return NULL;
+  }
+  return rec;
+}
+
+// length of the records at the start of a log that restoring would replay
+static long ok_ckpt_valid_end(FILE* f) {
+  long end = 0;
+  uint8_t* rec;
+  while ((rec = ok_ckpt_read_record(f)) != NULL) {
+    end += OK_CKPT_HEADER + (long) ok_get_bytes(rec, 12, 4) + 4;
+    free(rec);
+  }
+  return end;
+}
+
+int ok_ckpt_open(OkCheckpoint* c, uint8_t* ram, const char* path) {
+  // drop a torn record so new ones aren't appended after it, but only
+  // after a good one: without any, this is something else, not a log
+  c->log = NULL;
+  FILE* f = fopen(path, "rb");
+  if (f) {
+    long end = ok_ckpt_valid_end(f);
+    int torn = fseek(f, 0, SEEK_END) == 0 && ftell(f) != end;
+    fclose(f);
+    if (torn && (end == 0 || truncate(path, end) != 0)) return 0;
+  }
+
+  c->ram = ram;
+  c->log = fopen(path, "ab");
+  c->seq = 0;
+  c->full = 1;
+  for (size_t i = 0; i < sizeof(c->dirty) / sizeof(c->dirty[0]); i++) {
+    c->dirty[i] = 0;
+  }
+  return c->log != NULL;
+}
+
+void ok_ckpt_close(OkCheckpoint* c) {
+  if (c->log) fclose(c->log);
+  c->log = NULL;
+}
+
+void ok_ckpt_mark_range(OkCheckpoint* c, size_t address, size_t len) {
+  if (len == 0) return;
+  if (len > OK_MEM_SIZE) len = OK_MEM_SIZE;
+  for (size_t a = address & ~(size_t) (OK_CKPT_PAGE - 1); a < address + len;
+       a += OK_CKPT_PAGE) {
+    ok_ckpt_mark(c, a);
+  }
+}
+
+void ok_ckpt_clean(OkCheckpoint* c) {
+  for (size_t i = 0; i < sizeof(c->dirty) / sizeof(c->dirty[0]); i++) {
+    c->dirty[i] = 0;
+  }
+  c->full = 0;
+}
+
+static int ok_ckpt_page_dirty(const OkCheckpoint* c, size_t page) {
+  return (c->dirty[page / 64] >> (page % 64)) & 1;
+}
+
+static int ok_ckpt_page_zero(const uint8_t* page) {
+  for (size_t i = 0; i < OK_CKPT_PAGE; i++) {
+    if (page[i]) return 0;
+  }
+  return 1;
+}
+
+// whether a page goes into the next checkpoint
+static int ok_ckpt_wanted(const OkCheckpoint* c, size_t page) {
+  if (c->full) return !ok_ckpt_page_zero(c->ram + page * OK_CKPT_PAGE);
+  return ok_ckpt_page_dirty(c, page);
+}
+
+int ok_ckpt_save(OkCheckpoint* c, const OkState* s) {
+  if (!c->log) return 0;
+
+  uint32_t npages = 0;
+  for (size_t p = 0; p < OK_CKPT_PAGES; p++) npages += ok_ckpt_wanted(c, p);
+
+  size_t body = OK_CKPT_STATE + (size_t) npages * (4 + OK_CKPT_PAGE);
+  uint8_t* rec = malloc(OK_CKPT_HEADER + body + 4);
+  if (!rec) return 0;
+
+  ok_set_bytes(rec, 0, 4, OK_CKPT_MAGIC);
+  ok_set_bytes(rec, 4, 4, c->full ? OK_CKPT_FULL : 0);
+  ok_set_bytes(rec, 8, 4, npages);
+  ok_set_bytes(rec, 12, 4, (uint32_t) body);
+
+  uint8_t* at = rec + OK_CKPT_HEADER;
+  *at++ = s->d;
+  memcpy(at, s->dst, 256);
+  at += 256;
+  *at++ = s->r;
+  memcpy(at, s->rst, 256);
+  at += 256;
+  ok_set_bytes(at, 0, 4, (uint32_t) ((uint64_t) s->pc >> 32));
+  ok_set_bytes(at, 4, 4, (uint32_t) s->pc);
+  at += 8;
+  *at++ = (uint8_t) s->status;
+
+  for (size_t p = 0; p < OK_CKPT_PAGES; p++) {
+    if (!ok_ckpt_wanted(c, p)) continue;
+    ok_set_bytes(at, 0, 4, (uint32_t) p);
+    memcpy(at + 4, c->ram + p * OK_CKPT_PAGE, OK_CKPT_PAGE);
+    at += 4 + OK_CKPT_PAGE;
+  }
+  ok_set_bytes(at, 0, 4, ok_ckpt_hash(rec, OK_CKPT_HEADER + body));
+
+  size_t len = OK_CKPT_HEADER + body + 4;
+  int ok = fwrite(rec, 1, len, c->log) == len && fflush(c->log) == 0;
+  free(rec);
+  if (!ok) return 0;
+
+  ok_ckpt_clean(c);
+  c->seq++;
+  return 1;
+}
+
+uint32_t ok_ckpt_restore(const char* path, uint8_t* ram, OkState* s) {
+  FILE* f = fopen(path, "rb");
+  if (!f) return 0;
+
+  // each whole record is checked before touching ram
+  uint32_t restored = 0;
+  uint8_t* rec;
+  while ((rec = ok_ckpt_read_record(f)) != NULL) {
+    uint32_t flags = ok_get_bytes(rec, 4, 4);
+    uint32_t npages = ok_get_bytes(rec, 8, 4);
+
+    uint8_t* at = rec + OK_CKPT_HEADER;
+    s->d = *at++;
+    memcpy(s->dst, at, 256);
+    at += 256;
+    s->r = *at++;
+    memcpy(s->rst, at, 256);
+    at += 256;
+    s->pc = (size_t) (((uint64_t) ok_get_bytes(at, 0, 4) << 32)
+      | ok_get_bytes(at, 4, 4));
+    at += 8;
+    s->status = (OkStatus) *at++;
+
+    if (flags & OK_CKPT_FULL) memset(ram, 0, OK_MEM_SIZE);
+    for (uint32_t i = 0; i < npages; i++) {
+      size_t p = ok_get_bytes(at, 0, 4) % OK_CKPT_PAGES;
+      memcpy(ram + p * OK_CKPT_PAGE, at + 4, OK_CKPT_PAGE);
+      at += 4 + OK_CKPT_PAGE;
+    }
+
+    free(rec);
+    restored++;
+  }
+
+  fclose(f);
+  return restored;
+}
+
+#endif // OK_IMPLEMENTATION
+
+#endif // OK_CKPT_H
@@ -0,0 +1,587 @@
+#ifndef OK_CODE_H
+#define OK_CODE_H
+
+#include "ok.h"
+
+// decoded ROM code
+//
+// ok_code_build decodes a ROM once into an OkCode: an instruction record for
+// every ROM address (so jumps may land anywhere), which blocks each address
+// starts or ends, and the targets of `lit`+`jmp` pairs. ok_code_run then
+// executes an OkState from it a block at a time: the OkInsn.run
+// instructions from where it is up to the block's end run back to back,
+// without going through ok_fetch, decoding again or checking for the end of
+// the code, on handlers specialized for each instruction byte. Hooks are
+// called one instruction at a time. Anything the code doesn't cover
+// (addresses past the end of the ROM, or a `lit` whose bytes run past it) is
+// handed to ok_tick, so running from code always behaves exactly like
+// ticking.
+//
+// Decoding can be cached across processes: ok_code_load looks in a cache
+// directory for a file keyed by a hash of the ROM and OK_CODE_VERSION, maps
+// it in if it matches the ROM byte for byte and its instruction records
+// match the checksum they were saved with, and otherwise decodes the ROM and
+// saves the result for next time.
+//
+// Code is immutable once built, so any number of threads can run from the
+// same OkCode at once. It is reference counted: ok_code_retain adds a
+// reference and ok_code_free drops one. An OkCodeCache shares one OkCode per
+// distinct ROM between every VM instance asking for it, publishing new
+// entries without locks. Code describes the ROM as it was when decoded, so
+// an instance whose ROM the host modifies updates its code with
+// ok_code_write, which copies shared code before changing it.
+
+#define OK_CODE_VERSION (2) // bump whenever OkInsn or the file format changes
+
+// instruction flags
+#define OK_CODE_LEADER (1 << 0) // entry point or static jump target
+#define OK_CODE_END (1 << 1) // ends a block (`jmp` or halt)
+#define OK_CODE_PARTIAL (1 << 2) // runs past the end of the ROM
+
+typedef struct {
+  uint8_t instr; // instruction byte
+  uint8_t len; // encoded length in bytes
+  uint8_t flags;
+  uint8_t run; // instructions from here to the end of the block, at most
+               // 255, or 0 if this one is left to ok_tick
+  uint32_t imm; // `lit` immediate
+} OkInsn;
+
+typedef struct {
+  size_t len; // ROM bytes covered
+  uint64_t hash; // hash of those bytes
+  uint8_t* rom; // copy of those bytes
+  OkInsn* insns; // one per ROM address
+  void* map; // file mapping rom and insns live in, if it was loaded
+  size_t map_size;
+  uint32_t refs; // references held, updated atomically
+} OkCode;
+
+#ifndef OK_CODE_CACHE_SLOTS
+#define OK_CODE_CACHE_SLOTS (64) // most distinct ROMs a cache shares
+#endif
+
+typedef struct {
+  OkCode* slots[OK_CODE_CACHE_SLOTS]; // published atomically, never removed
+  const char* dir; // on-disk cache directory, or NULL
+} OkCodeCache;
+
+// decode a ROM (trailing zero bytes are left to ok_tick). Returns NULL if
+// out of memory.
+OkCode* ok_code_build(const uint8_t* rom, size_t len);
+
+// decode a ROM through the cache directory dir. Returns NULL if out of
+// memory; problems with the cache only make it fall back to decoding.
+OkCode* ok_code_load(const uint8_t* rom, size_t len, const char* dir);
+
+// save code for rom into the cache directory. Returns 1 on success, 0 on
+// failure.
+int ok_code_save(const OkCode* c, const uint8_t* rom, const char* dir);
+
+// add a reference to c; returns c
+OkCode* ok_code_retain(OkCode* c);
+
+// drop a reference to c, freeing it along with the last one
+void ok_code_free(OkCode* c);
+
+// set up a shared cache, backed by the on-disk cache in dir if not NULL
+void ok_code_cache_init(OkCodeCache* cache, const char* dir);
+
+// drop the cache's references; nobody may be using the cache itself anymore
+void ok_code_cache_destroy(OkCodeCache* cache);
+
+// code for a ROM, shared with everyone else asking the cache for the same
+// ROM bytes. Drop it with ok_code_free. Returns NULL if out of memory.
+OkCode* ok_code_cache_get(OkCodeCache* cache, const uint8_t* rom, size_t len);
+
+// code for c's ROM with the byte at address set to val. Shared code is
+// copied first, and the caller's reference moves to the returned code.
+// Returns NULL (dropping the reference) if out of memory.
+OkCode* ok_code_write(OkCode* c, size_t address, uint8_t val);
+
+// run s from code for at most max instructions, or until it stops. Returns
+// how many instructions ran.
+uint64_t ok_code_run(const OkCode* c, OkState* s, uint64_t max);
+
+#ifdef OK_IMPLEMENTATION
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define OK_CODE_MAGIC (0x4f4b434f44450000ull) // "OKCODE\0\0"
+#define OK_CODE_HEADER (64) // bytes before the ROM copy in a cache file
+
+// FNV-1a over the ROM bytes
+static uint64_t ok_code_hash(const uint8_t* rom, size_t len) {
+  uint64_t h = 14695981039346656037ull;
+  for (size_t i = 0; i < len; i++) h = (h ^ rom[i]) * 1099511628211ull;
+  return h;
+}
+
+// FNV-1a over the instruction records, a word at a time; every step is a
+// bijection, so changing any one word always changes the sum
+static uint64_t ok_code_sum(const OkInsn* insns, size_t len) {
+  uint64_t h = 14695981039346656037ull;
+  for (size_t i = 0; i < len; i++) {
+    uint64_t word;
+    memcpy(&word, &insns[i], sizeof(word));
+    h = (h ^ word) * 1099511628211ull;
+  }
+  return h;
+}
+
+// ROM bytes worth decoding: everything up to the last nonzero byte
+static size_t ok_code_trim(const uint8_t* rom, size_t len) {
+  while (len > 0 && rom[len - 1] == 0) len--;
+  return len;
+}
+
+static void ok_code_decode(OkInsn* insns, const uint8_t* rom, size_t len) {
+  for (size_t a = 0; a < len; a++) {
+    OkInsn* insn = &insns[a];
+    insn->instr = rom[a];
+    insn->len = 1;
+    insn->flags = 0;
+    insn->imm = 0;
+
+    if ((rom[a] & 0x80) == 0 || (rom[a] & 0x0f) == OK_JMP) {
+      insn->flags |= OK_CODE_END;
+    } else if ((rom[a] & 0x0f) == OK_LIT) {
+      uint8_t width = ((rom[a] >> 4) & 3) + 1;
+      insn->len += width;
+      if (a + insn->len > len) {
+        insn->flags |= OK_CODE_PARTIAL;
+        continue;
+      }
+      for (uint8_t i = 0; i < width; i++) {
+        insn->imm = (insn->imm << 8) | rom[a + 1 + i];
+      }
+    }
+  }
+
+  // static jump targets, from `lit` immediately followed by `jmp`
+  if (len > 0) insns[0].flags |= OK_CODE_LEADER;
+  for (size_t a = 0; a < len; a++) {
+    const OkInsn* insn = &insns[a];
+    size_t next = a + insn->len;
+    if ((insn->instr & 0x8f) != (0x80 | OK_LIT) || (insn->flags & OK_CODE_PARTIAL)
+        || next >= len || (insns[next].instr & 0x8f) != (0x80 | OK_JMP)) {
+      continue;
+    }
+    if (insn->imm < len) insns[insn->imm].flags |= OK_CODE_LEADER;
+    if (next + 1 < len) insns[next + 1].flags |= OK_CODE_LEADER;
+  }
+
+  // distance to the end of each block, walking backwards
+  for (size_t a = len; a-- > 0;) {
+    OkInsn* insn = &insns[a];
+    size_t next = a + insn->len;
+    if (insn->flags & OK_CODE_PARTIAL) {
+      insn->run = 0;
+    } else if ((insn->flags & OK_CODE_END) || next >= len) {
+      insn->run = 1;
+    } else {
+      insn->run = insns[next].run < 255 ? insns[next].run + 1 : 255;
+    }
+  }
+}
+
+// unshared, undecoded code with room for len bytes
+static OkCode* ok_code_alloc(size_t len) {
+  OkCode* c = malloc(sizeof(OkCode));
+  if (!c) return NULL;
+  c->len = len;
+  c->map = NULL;
+  c->map_size = 0;
+  c->refs = 1;
+  c->rom = malloc(len ? len : 1);
+  c->insns = malloc(sizeof(OkInsn) * (len ? len : 1));
+  if (!c->rom || !c->insns) {
+    free(c->rom);
+    free(c->insns);
+    free(c);
+    return NULL;
+  }
+  return c;
+}
+
+OkCode* ok_code_build(const uint8_t* rom, size_t len) {
+  len = ok_code_trim(rom, len);
+
+  OkCode* c = ok_code_alloc(len);
+  if (!c) return NULL;
+  memcpy(c->rom, rom, len);
+  c->hash = ok_code_hash(rom, len);
+  ok_code_decode(c->insns, rom, len);
+  return c;
+}
+
+OkCode* ok_code_retain(OkCode* c) {
+  __atomic_add_fetch(&c->refs, 1, __ATOMIC_RELAXED);
+  return c;
+}
+
+void ok_code_free(OkCode* c) {
+  if (!c || __atomic_sub_fetch(&c->refs, 1, __ATOMIC_ACQ_REL) != 0) return;
+  if (c->map) {
+    munmap(c->map, c->map_size);
+  } else {
+    free(c->rom);
+    free(c->insns);
+  }
+  free(c);
+}
+
+// cache file layout: header, ROM copy (padded to 8 bytes), then the insns
+static size_t ok_code_insns_at(size_t len) {
+  return OK_CODE_HEADER + ((len + 7) & ~(size_t) 7);
+}
+
+static void ok_code_path(char* path, size_t size, const char* dir, uint64_t hash) {
+  snprintf(path, size, "%s/%016llx-v%d.okc", dir, (unsigned long long) hash,
+    OK_CODE_VERSION);
+}
+
+// fill in a cache file header
+static void ok_code_header(uint8_t* h, size_t len, uint64_t hash,
+                           uint64_t sum) {
+  memset(h, 0, OK_CODE_HEADER);
+  uint64_t fields[7] = { OK_CODE_MAGIC, OK_CODE_VERSION, sizeof(OkInsn),
+    0x0102030405060708ull, len, hash, sum }; // native byte order marker
+  memcpy(h, fields, sizeof(fields));
+}
+
+int ok_code_save(const OkCode* c, const uint8_t* rom, const char* dir) {
+  char path[4096], tmp[4096 + 32];
+  ok_code_path(path, sizeof(path), dir, c->hash);
+  snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", path, (long) getpid());
+
+  // write a private file, then rename it into place so readers never see
+  // half of one
+  FILE* f = fopen(tmp, "wb");
+  if (!f) return 0;
+
+  uint8_t header[OK_CODE_HEADER];
+  static const uint8_t pad[8];
+  ok_code_header(header, c->len, c->hash, ok_code_sum(c->insns, c->len));
+  size_t padding = ok_code_insns_at(c->len) - OK_CODE_HEADER - c->len;
+
+  int ok = fwrite(header, 1, OK_CODE_HEADER, f) == OK_CODE_HEADER
+    && fwrite(rom, 1, c->len, f) == c->len
+    && fwrite(pad, 1, padding, f) == padding
+    && fwrite(c->insns, sizeof(OkInsn), c->len, f) == c->len;
+  ok = fclose(f) == 0 && ok;
+
+  if (ok) ok = rename(tmp, path) == 0;
+  if (!ok) remove(tmp);
+  return ok;
+}
+
+// map a cache file in; returns NULL if it is missing or doesn't match rom
+static OkCode* ok_code_map(const uint8_t* rom, size_t len, uint64_t hash,
+                           const char* dir) {
+  char path[4096];
+  ok_code_path(path, sizeof(path), dir, hash);
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return NULL;
+  struct stat st;
+  size_t size = ok_code_insns_at(len) + sizeof(OkInsn) * len;
+  if (fstat(fd, &st) != 0 || (size_t) st.st_size != size) {
+    close(fd);
+    return NULL;
+  }
+
+  void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return NULL;
+
+  // the records are only trusted if they are the ones that were saved
+  const OkInsn* insns =
+    (const OkInsn*) ((uint8_t*) map + ok_code_insns_at(len));
+  uint8_t header[OK_CODE_HEADER];
+  ok_code_header(header, len, hash, ok_code_sum(insns, len));
+  if (memcmp(map, header, OK_CODE_HEADER) != 0
+      || memcmp((uint8_t*) map + OK_CODE_HEADER, rom, len) != 0) {
+    munmap(map, size);
+    return NULL;
+  }
+
+  OkCode* c = malloc(sizeof(OkCode));
+  if (!c) {
+    munmap(map, size);
+    return NULL;
+  }
+  c->len = len;
+  c->hash = hash;
+  c->rom = (uint8_t*) map + OK_CODE_HEADER;
+  c->insns = (OkInsn*) insns;
+  c->map = map;
+  c->map_size = size;
+  c->refs = 1;
+  return c;
+}
+
+OkCode* ok_code_load(const uint8_t* rom, size_t len, const char* dir) {
+  len = ok_code_trim(rom, len);
+  if (dir && len > 0) {
+    OkCode* c = ok_code_map(rom, len, ok_code_hash(rom, len), dir);
+    if (c) return c;
+  }
+
+  OkCode* c = ok_code_build(rom, len);
+  if (c && dir && len > 0) ok_code_save(c, rom, dir);
+  return c;
+}
+
+void ok_code_cache_init(OkCodeCache* cache, const char* dir) {
+  for (int i = 0; i < OK_CODE_CACHE_SLOTS; i++) cache->slots[i] = NULL;
+  cache->dir = dir;
+}
+
+void ok_code_cache_destroy(OkCodeCache* cache) {
+  for (int i = 0; i < OK_CODE_CACHE_SLOTS; i++) {
+    ok_code_free(cache->slots[i]);
+    cache->slots[i] = NULL;
+  }
+}
+
+static int ok_code_matches(const OkCode* c, const uint8_t* rom, size_t len,
+                           uint64_t hash) {
+  return c->hash == hash && c->len == len && memcmp(c->rom, rom, len) == 0;
+}
+
+OkCode* ok_code_cache_get(OkCodeCache* cache, const uint8_t* rom, size_t len) {
+  len = ok_code_trim(rom, len);
+  uint64_t hash = ok_code_hash(rom, len);
+  OkCode* built = NULL;
+
+  // entries are only ever added, so anything found stays valid while the
+  // cache does; the probe restarts at the slot a racing insert took
+  for (int i = 0; i < OK_CODE_CACHE_SLOTS; i++) {
+    OkCode** slot = &cache->slots[(hash + i) % OK_CODE_CACHE_SLOTS];
+    OkCode* c = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+
+    if (!c) {
+      if (!built) built = ok_code_load(rom, len, cache->dir);
+      if (!built) return NULL;
+      ok_code_retain(built); // the cache's reference
+      if (__atomic_compare_exchange_n(slot, &c, built, 0, __ATOMIC_ACQ_REL,
+                                      __ATOMIC_ACQUIRE)) {
+        return built;
+      }
+      __atomic_sub_fetch(&built->refs, 1, __ATOMIC_RELAXED); // lost the race
+    }
+
+    if (ok_code_matches(c, rom, len, hash)) {
+      ok_code_free(built);
+      return ok_code_retain(c);
+    }
+  }
+
+  // the cache is full, so this ROM gets code of its own
+  return built ? built : ok_code_load(rom, len, cache->dir);
+}
+
+OkCode* ok_code_write(OkCode* c, size_t address, uint8_t val) {
+  size_t len = address < c->len ? c->len : address + 1;
+
+  // code nobody else holds (and that isn't a read-only mapping) can be
+  // changed in place, anything else is copied first
+  OkCode* w = c;
+  if (c->map || len != c->len
+      || __atomic_load_n(&c->refs, __ATOMIC_ACQUIRE) != 1) {
+    w = ok_code_alloc(len);
+    if (w) {
+      memcpy(w->rom, c->rom, c->len);
+      memset(w->rom + c->len, 0, len - c->len);
+    }
+    ok_code_free(c);
+    if (!w) return NULL;
+  }
+
+  w->rom[address] = val;
+  w->len = ok_code_trim(w->rom, len);
+  w->hash = ok_code_hash(w->rom, w->len);
+  ok_code_decode(w->insns, w->rom, w->len);
+  return w;
+}
+
+// ok_dst_pop and ok_dst_push on a copy of s->d, which can stay in a register
+// where bytes stored to s->dst would otherwise make s->d be reloaded after
+// each one. Popping an empty stack reads 0, as ok_dst_pop reads s->d there.
+static inline uint32_t ok_code_pop(OkState* s, uint8_t* d, int n) {
+  uint32_t out = 0;
+  for (int i = 0; i < n; i++) {
+    uint8_t byte = *d ? s->dst[*d - 1] : 0;
+    s->dst[(*d)--] = 0;
+    out |= (uint32_t) byte << (8 * i);
+  }
+  return out;
+}
+
+static inline void ok_code_push(OkState* s, uint8_t* d, int n, uint32_t val) {
+  for (int i = n - 1; i >= 0; i--) s->dst[(*d)++] = (uint8_t) (val >> (8 * i));
+}
+
+// every instruction without the skip flag at width W, and conditional jumps,
+// with W a constant so the stack loops unroll; the rest are left to
+// handle_opcode
+#define OK_CODE_CASES(W) \
+  case 0x80 | (W - 1) << 4 | OK_ADD: \
+    b = ok_code_pop(s, &d, W); \
+    a = ok_code_pop(s, &d, W); \
+    ok_code_push(s, &d, W, a + b); \
+    break; \
+  case 0x80 | (W - 1) << 4 | OK_AND: \
+    b = ok_code_pop(s, &d, W); \
+    a = ok_code_pop(s, &d, W); \
+    ok_code_push(s, &d, W, a & b); \
+    break; \
+  case 0x80 | (W - 1) << 4 | OK_XOR: \
+    b = ok_code_pop(s, &d, W); \
+    a = ok_code_pop(s, &d, W); \
+    ok_code_push(s, &d, W, a ^ b); \
+    break; \
+  case 0x80 | (W - 1) << 4 | OK_SHF: \
+    b = ok_code_pop(s, &d, 1); \
+    a = ok_code_pop(s, &d, W); \
+    ok_code_push(s, &d, W, (a >> (b & 0x0f)) << (b >> 4)); \
+    break; \
+  case 0x80 | (W - 1) << 4 | OK_SWP: \
+    b = ok_code_pop(s, &d, W); \
+    a = ok_code_pop(s, &d, W); \
+    ok_code_push(s, &d, W, b); \
+    ok_code_push(s, &d, W, a); \
+    break; \
+  case 0x80 | (W - 1) << 4 | OK_CMP: \
+    b = ok_code_pop(s, &d, W); \
+    a = ok_code_pop(s, &d, W); \
+    ok_code_push(s, &d, 1, a > b ? 1 : a < b ? 255 : 0); \
+    break; \
+  case 0x80 | (W - 1) << 4 | OK_STR: \
+    addr = ok_code_pop(s, &d, OK_WORD_SIZE); \
+    for (int i = W - 1; i >= 0; i--) { \
+      OK_MEM_WRITE(addr + i, ok_code_pop(s, &d, 1)); \
+    } \
+    break; \
+  case 0x80 | (W - 1) << 4 | OK_LOD: \
+    addr = ok_code_pop(s, &d, OK_WORD_SIZE); \
+    for (int i = 0; i < W; i++) ok_code_push(s, &d, 1, OK_MEM_READ(addr + i)); \
+    break; \
+  case 0x80 | (W - 1) << 4 | OK_DUP: \
+    a = ok_code_pop(s, &d, W); \
+    ok_code_push(s, &d, W, a); \
+    ok_code_push(s, &d, W, a); \
+    break; \
+  case 0x80 | (W - 1) << 4 | OK_DRP: \
+    ok_code_pop(s, &d, W); \
+    break; \
+  case 0x80 | (W - 1) << 4 | OK_PSH: \
+    ok_rst_push(s, W, ok_code_pop(s, &d, W)); \
+    break; \
+  case 0x80 | (W - 1) << 4 | OK_POP: \
+    ok_code_push(s, &d, W, ok_rst_pop(s, W)); \
+    break; \
+  case 0x80 | (W - 1) << 4 | OK_JMP: \
+    pc = ok_code_pop(s, &d, W); \
+    break; \
+  case 0xc0 | (W - 1) << 4 | OK_JMP: \
+    addr = ok_code_pop(s, &d, W); \
+    if (ok_code_pop(s, &d, 1) != 0) pc = addr; \
+    else ok_code_push(s, &d, W, addr); \
+    break; \
+  case 0x80 | (W - 1) << 4 | OK_LIT: \
+    ok_code_push(s, &d, W, insn->imm); \
+    break; \
+  case 0x80 | (W - 1) << 4 | OK_FET: \
+    addr = ok_code_pop(s, &d, OK_WORD_SIZE); \
+    for (int i = 0; i < W; i++) ok_code_push(s, &d, 1, OK_FETCH(addr + i)); \
+    break; \
+  case 0x80 | (W - 1) << 4 | OK_NOP: \
+    break;
+
+// run the n instructions from s->pc, which are all in the same block, with
+// the stack and program counters kept in locals until it ends. Returns the
+// last one's instruction byte.
+static uint8_t ok_code_block(const OkCode* c, OkState* s, uint32_t n) {
+  const OkInsn* insn;
+  uint32_t a, b;
+  size_t addr;
+  uint8_t d = s->d;
+  size_t pc = s->pc;
+  do {
+    insn = &c->insns[pc];
+    pc += insn->len;
+    switch (insn->instr) {
+      OK_CODE_CASES(1)
+      OK_CODE_CASES(2)
+      OK_CODE_CASES(3)
+      OK_CODE_CASES(4)
+      default:
+        s->d = d;
+        s->pc = pc;
+        if ((insn->instr & 0x80) == 0) {
+          s->status = OK_HALTED;
+        } else if ((insn->instr & 0x0f) == OK_LIT) {
+          // push the decoded immediate, unless a zero flag skips it
+          if (ok_dst_pop(s, 1) != 0) ok_dst_push(s, insn->len - 1, insn->imm);
+        } else {
+          handle_opcode(s, insn->instr & 0x0f, (insn->instr >> 4) & 3, 1);
+        }
+        d = s->d;
+        pc = s->pc;
+    }
+  } while (--n > 0);
+  s->d = d;
+  s->pc = pc;
+  return insn->instr;
+}
+
+#undef OK_CODE_CASES
+
+// run one instruction from code, exactly like ok_tick (with hooks, like
+// ok_run). Returns 0 if a hook stopped the VM before it.
+static inline int ok_code_step(const OkCode* c, OkState* s) {
+  size_t pc = s->pc;
+  if (pc >= c->len || c->insns[pc].run == 0) {
+    if (s->hooks) return ok_hooked_tick(s);
+    ok_tick(s);
+    return 1;
+  }
+
+  if (s->hooks && !ok_hooks_call(s, c->insns[pc].instr)) return 0;
+  ok_code_block(c, s, 1);
+  return 1;
+}
+
+uint64_t ok_code_run(const OkCode* c, OkState* s, uint64_t max) {
+  uint64_t n = 0;
+  if (s->hooks) {
+    while (s->status == OK_RUNNING && n < max && ok_code_step(c, s)) n++;
+    return n;
+  }
+
+  // a block at a time, cut short if it would go past max
+  while (s->status == OK_RUNNING && n < max) {
+    uint32_t run = s->pc < c->len ? c->insns[s->pc].run : 0;
+    if (run == 0) {
+      ok_tick(s);
+      n++;
+      continue;
+    }
+    if (run > max - n) run = (uint32_t) (max - n);
+    ok_code_block(c, s, run);
+    n += run;
+  }
+  return n;
+}
+
+#endif // OK_IMPLEMENTATION
+
+#endif // OK_CODE_H
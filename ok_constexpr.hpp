@@ -0,0 +1,244 @@
+#ifndef OK_CONSTEXPR_HPP
+#define OK_CONSTEXPR_HPP
+
+#include "ok.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// compile-time evaluator (C++20)
+//
+// ok::Vm is a constexpr version of the VM in ok.h, with RAM held in a
+// std::array, so a ROM embedded as a byte array can run while compiling and
+// leave its RAM or stacks behind as constants:
+//
+//   constexpr std::array<std::uint8_t, 8> rom = { ... };
+//   constexpr auto vm = ok::run<256>(rom);
+//   static_assert(vm.status == OK_HALTED);
+//   constexpr auto table = vm.ram;
+//
+// It executes exactly like ok_tick, down to the stack pointers wrapping
+// around and popping an empty stack (reading the byte before the stack in
+// ok.h, which is its stack pointer, so 0). The only differences come from
+// having no emulator: fetching past the end of the ROM gives 0 (a halt), a
+// RAM access past the end of the RAM stops the VM with OK_PANIC without
+// making it, and there are no devices.
+//
+// Compilers cap how much work a constant expression may do; for GCC and
+// Clang, raise -fconstexpr-ops-limit / -fconstexpr-steps for long programs.
+
+namespace ok {
+
+template <std::size_t RamSize>
+struct Vm {
+  std::uint8_t d = 0; // data stack pointer
+  std::array<std::uint8_t, 256> dst{}; // circular data stack
+  std::uint8_t r = 0; // return stack pointer
+  std::array<std::uint8_t, 256> rst{}; // circular return stack
+  std::size_t pc = 0; // program counter
+  OkStatus status = OK_RUNNING;
+  std::uint64_t steps = 0; // instructions run
+  std::array<std::uint8_t, RamSize> ram{};
+
+  constexpr void dst_push(std::uint8_t n, std::uint32_t val) {
+    for (int i = n - 1; i >= 0; i--) {
+      dst[d++] = (std::uint8_t) (val >> (8 * i));
+    }
+  }
+
+  constexpr std::uint32_t dst_pop(std::uint8_t n) {
+    std::uint32_t out = 0;
+    for (int i = 0; i < n; i++) {
+      std::uint8_t byte = d == 0 ? 0 : dst[d - 1];
+      dst[d--] = 0;
+      out |= (std::uint32_t) byte << (8 * i);
+    }
+    return out;
+  }
+
+  constexpr void rst_push(std::uint8_t n, std::uint32_t val) {
+    for (int i = n - 1; i >= 0; i--) {
+      rst[r++] = (std::uint8_t) (val >> (8 * i));
+    }
+  }
+
+  constexpr std::uint32_t rst_pop(std::uint8_t n) {
+    std::uint32_t out = 0;
+    for (int i = 0; i < n; i++) {
+      std::uint8_t byte = r == 0 ? 0 : rst[r - 1];
+      rst[r--] = 0;
+      out |= (std::uint32_t) byte << (8 * i);
+    }
+    return out;
+  }
+
+  // value of the top n bytes of the data stack, without popping them
+  constexpr std::uint32_t top(std::uint8_t n) const {
+    std::uint32_t out = 0;
+    for (int i = n; i > 0; i--) out = (out << 8) | dst[(std::uint8_t) (d - i)];
+    return out;
+  }
+
+  constexpr std::uint8_t mem_read(std::size_t address) {
+    if (address < RamSize) return ram[address];
+    status = OK_PANIC;
+    return 0;
+  }
+
+  constexpr void mem_write(std::size_t address, std::uint8_t val) {
+    if (address < RamSize) ram[address] = val;
+    else status = OK_PANIC;
+  }
+
+  template <std::size_t RomSize>
+  static constexpr std::uint8_t fetch(
+      const std::array<std::uint8_t, RomSize>& rom, std::size_t address) {
+    return address < RomSize ? rom[address] : 0;
+  }
+
+  // run one instruction, like ok_tick
+  template <std::size_t RomSize>
+  constexpr OkStatus tick(const std::array<std::uint8_t, RomSize>& rom) {
+    std::uint8_t instr = fetch(rom, pc++);
+    steps++;
+    if ((instr & 0x80) == 0) {
+      status = OK_HALTED;
+      return status;
+    }
+
+    std::uint8_t w = ((instr >> 4) & 3) + 1;
+    bool skip = (instr & 0x40) != 0;
+    std::uint32_t a, b, n;
+    std::size_t addr;
+
+    // with the skip flag, a zero flag restores whatever was popped
+    switch ((OkOpcode) (instr & 0x0f)) {
+      case OK_ADD:
+      case OK_AND:
+      case OK_XOR:
+        b = dst_pop(w);
+        a = dst_pop(w);
+        if (skip && dst_pop(1) == 0) {
+          dst_push(w, a);
+          dst_push(w, b);
+        } else if ((instr & 0x0f) == OK_ADD) {
+          dst_push(w, a + b);
+        } else if ((instr & 0x0f) == OK_AND) {
+          dst_push(w, a & b);
+        } else {
+          dst_push(w, a ^ b);
+        }
+        break;
+      case OK_SHF: {
+        std::uint8_t by = (std::uint8_t) dst_pop(1);
+        n = dst_pop(w);
+        if (skip && dst_pop(1) == 0) {
+          dst_push(w, n);
+          dst_push(1, by);
+        } else {
+          dst_push(w, (n >> (by & 0x0f)) << (by >> 4));
+        }
+        break;
+      }
+      case OK_SWP:
+        b = dst_pop(w);
+        a = dst_pop(w);
+        if (skip && dst_pop(1) == 0) {
+          dst_push(w, a);
+          dst_push(w, b);
+        } else {
+          dst_push(w, b);
+          dst_push(w, a);
+        }
+        break;
+      case OK_CMP:
+        b = dst_pop(w);
+        a = dst_pop(w);
+        if (skip && dst_pop(1) == 0) {
+          dst_push(w, a);
+          dst_push(w, b);
+        } else {
+          dst_push(1, a > b ? 1 : a < b ? 255 : 0);
+        }
+        break;
+      case OK_STR:
+        addr = dst_pop(OK_WORD_SIZE);
+        if (skip && dst_pop(1) == 0) {
+          dst_push(OK_WORD_SIZE, (std::uint32_t) addr);
+        } else {
+          for (int i = w - 1; i >= 0; i--) mem_write(addr + i, dst_pop(1));
+        }
+        break;
+      case OK_LOD:
+        addr = dst_pop(OK_WORD_SIZE);
+        if (skip && dst_pop(1) == 0) {
+          dst_push(OK_WORD_SIZE, (std::uint32_t) addr);
+        } else {
+          for (int i = 0; i < w; i++) dst_push(1, mem_read(addr + i));
+        }
+        break;
+      case OK_DUP:
+        n = dst_pop(w);
+        if (skip && dst_pop(1) == 0) {
+          dst_push(w, n);
+        } else {
+          dst_push(w, n);
+          dst_push(w, n);
+        }
+        break;
+      case OK_DRP:
+        n = dst_pop(w);
+        if (skip && dst_pop(1) == 0) dst_push(w, n);
+        break;
+      case OK_PSH:
+        n = dst_pop(w);
+        if (skip && dst_pop(1) == 0) dst_push(w, n);
+        else rst_push(w, n);
+        break;
+      case OK_POP:
+        n = rst_pop(w);
+        if (skip && dst_pop(1) == 0) rst_push(w, n);
+        else dst_push(w, n);
+        break;
+      case OK_JMP:
+        addr = dst_pop(w);
+        if (skip && dst_pop(1) == 0) dst_push(w, (std::uint32_t) addr);
+        else pc = addr;
+        break;
+      case OK_LIT:
+        if (skip && dst_pop(1) == 0) {
+          pc += w;
+        } else {
+          for (int i = 0; i < w; i++) dst_push(1, fetch(rom, pc++));
+        }
+        break;
+      case OK_FET:
+        addr = dst_pop(OK_WORD_SIZE);
+        if (skip && dst_pop(1) == 0) {
+          dst_push(OK_WORD_SIZE, (std::uint32_t) addr);
+        } else {
+          for (int i = 0; i < w; i++) dst_push(1, fetch(rom, addr + i));
+        }
+        break;
+      case OK_NOP:
+        if (skip) dst_pop(1);
+        break;
+    }
+    return status;
+  }
+};
+
+// run rom from the start on a fresh VM with RamSize bytes of RAM, until it
+// stops or has run max instructions (stopping with OK_OUT_OF_FUEL)
+template <std::size_t RamSize, std::size_t RomSize>
+constexpr Vm<RamSize> run(const std::array<std::uint8_t, RomSize>& rom,
+                          std::uint64_t max = 1000000) {
+  Vm<RamSize> vm;
+  while (vm.status == OK_RUNNING && vm.steps < max) vm.tick(rom);
+  if (vm.status == OK_RUNNING) vm.status = OK_OUT_OF_FUEL;
+  return vm;
+}
+
+} // namespace ok
+
+#endif // OK_CONSTEXPR_HPP
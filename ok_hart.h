@@ -0,0 +1,280 @@
+#ifndef OK_HART_H
+#define OK_HART_H
+
+#include "ok.h"
+#include <pthread.h>
+
+// multiple hardware threads ("harts") sharing one RAM image
+//
+// Each hart is an OkState running on its own host thread. All harts execute
+// the same ROM and share one RAM buffer, which the emulator's ok_mem_read and
+// ok_mem_write should access through ok_harts_load and ok_harts_store, and
+// route the OK_HART_BASE register window to ok_harts_read and ok_harts_write.
+//
+// Memory model:
+// - every RAM byte access is atomic on its own, but nothing more: `lod` reads
+//   its bytes in ascending address order and `str` writes them in descending
+//   order, so other harts may observe a multi-byte value half-written
+// - the atomic operations below act on a 1-4 byte big-endian value as a
+//   whole, atomically with respect to every other access to it, `str`
+//   included: each is a compare-and-swap loop on the aligned 8 bytes of RAM
+//   holding the value, so a byte stored in between makes it retry rather
+//   than get lost. The value must not cross an 8-byte boundary; operations
+//   on one that does fail. They are totally ordered with respect to each
+//   other, and are full fences for the hart issuing them
+// - spawning a hart happens-before its first instruction, and a hart halting
+//   happens-before a join that returns its status
+// - a join that would wait on itself, directly or through harts joining each
+//   other in a cycle, fails instead of deadlocking
+//
+// Register window (offsets from OK_HART_BASE), each register is big-endian
+// and private to the hart accessing it:
+// - ADDR (word): address operated on, or the pc to start a new hart at
+// - ARG (4 bytes): expected value for cas, addend for add, the value pushed
+//   onto a new hart's stack for spawn, or the hart id to join
+// - VALUE (4 bytes): new value for cas; after any operation, holds its
+//   result (the old value for cas and add, the new hart id for spawn, or the
+//   joined hart's status)
+// - CTRL (1 byte): writing starts an operation, with the operation in the low
+//   nibble and the operand width in bits 4-5 like an instruction's `aa`
+//   bits; operands are the low width bytes of ARG and VALUE. Reading gives
+//   this hart's id
+// - FLAG (1 byte): 1 if the last operation succeeded, 0 otherwise
+
+#ifndef OK_HART_MAX
+#define OK_HART_MAX (16) // most harts that can exist at once
+#endif
+
+#ifndef OK_HART_BASE
+#define OK_HART_BASE (0xffff80) // address of the register window
+#endif
+
+// register offsets
+#define OK_HART_ADDR (0)
+#define OK_HART_ARG (OK_HART_ADDR + OK_WORD_SIZE)
+#define OK_HART_VALUE (OK_HART_ARG + 4)
+#define OK_HART_CTRL (OK_HART_VALUE + 4)
+#define OK_HART_FLAG (OK_HART_CTRL + 1)
+#define OK_HART_SIZE (OK_HART_FLAG + 1) // size of the register window
+
+// operations written to CTRL
+#define OK_HART_CAS (1) // compare-and-swap
+#define OK_HART_FETCH_ADD (2) // fetch-and-add
+#define OK_HART_SPAWN (3) // start a new hart
+#define OK_HART_JOIN (4) // wait for a hart to halt
+
+typedef struct OkHarts OkHarts;
+
+typedef struct {
+  OkState state;
+  OkHarts* group;
+  pthread_t thread;
+  int slot; // 0 if free, 1 if running, 2 if someone is joining it
+  int joining; // id of the hart this one is waiting for, or -1
+  uint8_t regs[OK_HART_SIZE]; // this hart's view of the register window
+} OkHart;
+
+struct OkHarts {
+  uint8_t* ram; // shared RAM, OK_MEM_SIZE bytes, 8-byte aligned
+  pthread_mutex_t lock; // serializes hart bookkeeping
+  OkHart harts[OK_HART_MAX];
+};
+
+// set up a group of harts sharing ram, which must be 8-byte aligned (as
+// malloc's is). Returns 1 on success, 0 on failure.
+int ok_harts_init(OkHarts* g, uint8_t* ram);
+
+// join every hart still running and release the group
+void ok_harts_destroy(OkHarts* g);
+
+// start a new hart at pc. Returns its id, or -1 if OK_HART_MAX are running.
+int ok_harts_spawn(OkHarts* g, size_t pc);
+
+// wait for hart id to halt and free its slot. Returns its final status, or
+// OK_PANIC if there is no such hart (or it is being joined elsewhere, or
+// waiting would deadlock).
+OkStatus ok_harts_join(OkHarts* g, int id);
+
+// shared RAM accessors for ok_mem_read and ok_mem_write
+uint8_t ok_harts_load(OkHarts* g, size_t address);
+void ok_harts_store(OkHarts* g, size_t address, uint8_t val);
+
+// register window accessors, offset is relative to OK_HART_BASE
+uint8_t ok_harts_read(OkHarts* g, size_t offset);
+void ok_harts_write(OkHarts* g, size_t offset, uint8_t val);
+
+#ifdef OK_IMPLEMENTATION
+
+// the hart running on this thread, if any
+static _Thread_local OkHart* ok_hart_self;
+
+int ok_harts_init(OkHarts* g, uint8_t* ram) {
+  if ((uintptr_t) ram % 8 != 0) return 0;
+  g->ram = ram;
+  for (int i = 0; i < OK_HART_MAX; i++) {
+    g->harts[i].group = g;
+    g->harts[i].slot = 0;
+  }
+  return pthread_mutex_init(&g->lock, NULL) == 0;
+}
+
+void ok_harts_destroy(OkHarts* g) {
+  for (int i = 0; i < OK_HART_MAX; i++) ok_harts_join(g, i);
+  pthread_mutex_destroy(&g->lock);
+}
+
+static void* ok_hart_main(void* arg) {
+  OkHart* h = arg;
+  ok_hart_self = h;
+  while (ok_tick(&h->state) == OK_RUNNING);
+  return NULL;
+}
+
+// start a hart at pc with val (width bytes) on its stack; caller holds lock
+static int ok_harts_start(OkHarts* g, size_t pc, uint8_t width, uint32_t val) {
+  for (int i = 0; i < OK_HART_MAX; i++) {
+    OkHart* h = &g->harts[i];
+    if (h->slot != 0) continue;
+
+    ok_init(&h->state);
+    h->state.pc = pc;
+    h->joining = -1;
+    if (width > 0) ok_dst_push(&h->state, width, val);
+    for (int k = 0; k < OK_HART_SIZE; k++) h->regs[k] = 0;
+
+    if (pthread_create(&h->thread, NULL, ok_hart_main, h) != 0) return -1;
+    h->slot = 1;
+    return i;
+  }
+  return -1;
+}
+
+int ok_harts_spawn(OkHarts* g, size_t pc) {
+  pthread_mutex_lock(&g->lock);
+  int id = ok_harts_start(g, pc, 0, 0);
+  pthread_mutex_unlock(&g->lock);
+  return id;
+}
+
+// wait for hart id to halt; returns 0 if there was nothing to join
+static int ok_harts_reap(OkHarts* g, int id, OkStatus* status) {
+  if (id < 0 || id >= OK_HART_MAX || &g->harts[id] == ok_hart_self) return 0;
+  OkHart* h = &g->harts[id];
+
+  // claim the hart so nobody else joins it too, unless it is waiting on
+  // this one, directly or not
+  OkHart* self = ok_hart_self && ok_hart_self->group == g ? ok_hart_self : NULL;
+  pthread_mutex_lock(&g->lock);
+  int running = h->slot == 1;
+  for (int i = id; running && self && i >= 0; i = g->harts[i].joining) {
+    if (&g->harts[i] == self) running = 0;
+  }
+  if (running) h->slot = 2;
+  if (running && self) self->joining = id;
+  pthread_mutex_unlock(&g->lock);
+  if (!running) return 0;
+
+  pthread_join(h->thread, NULL);
+  *status = h->state.status;
+
+  pthread_mutex_lock(&g->lock);
+  h->slot = 0;
+  if (self) self->joining = -1;
+  pthread_mutex_unlock(&g->lock);
+  return 1;
+}
+
+OkStatus ok_harts_join(OkHarts* g, int id) {
+  OkStatus status = OK_PANIC;
+  ok_harts_reap(g, id, &status);
+  return status;
+}
+
+uint8_t ok_harts_load(OkHarts* g, size_t address) {
+  return __atomic_load_n(&g->ram[address], __ATOMIC_RELAXED);
+}
+
+void ok_harts_store(OkHarts* g, size_t address, uint8_t val) {
+  __atomic_store_n(&g->ram[address], val, __ATOMIC_RELAXED);
+}
+
+// compare-and-swap or fetch-and-add on the big-endian value of width bytes
+// at address, within one aligned 8-byte word. Sets *old to the value before,
+// and returns whether it was replaced.
+static int ok_harts_rmw(OkHarts* g, size_t address, uint8_t width, int op,
+                        uint32_t arg, uint32_t val, uint32_t* old) {
+  uint32_t mask = width == 4 ? 0xffffffff : ((uint32_t) 1 << (8 * width)) - 1;
+  uint64_t* word = (uint64_t*) (g->ram + (address & ~(size_t) 7));
+  size_t at = address & 7;
+  uint64_t seen = __atomic_load_n(word, __ATOMIC_SEQ_CST);
+  for (;;) {
+    uint8_t bytes[8];
+    memcpy(bytes, &seen, 8);
+    *old = ok_get_bytes(bytes, at, width);
+    if (op == OK_HART_CAS && *old != arg) return 0;
+    ok_set_bytes(bytes, at, width,
+      op == OK_HART_FETCH_ADD ? (*old + arg) & mask : val);
+
+    uint64_t next;
+    memcpy(&next, bytes, 8);
+    if (__atomic_compare_exchange_n(word, &seen, next, 0, __ATOMIC_SEQ_CST,
+                                    __ATOMIC_SEQ_CST)) {
+      return 1;
+    }
+  }
+}
+
+// run the operation just written to a hart's CTRL register
+static void ok_harts_exec(OkHarts* g, OkHart* h, uint8_t ctrl) {
+  uint8_t width = ((ctrl >> 4) & 3) + 1;
+  uint32_t mask = width == 4 ? 0xffffffff : ((uint32_t) 1 << (8 * width)) - 1;
+  size_t addr = ok_get_bytes(h->regs, OK_HART_ADDR, OK_WORD_SIZE);
+  uint32_t arg = ok_get_bytes(h->regs, OK_HART_ARG, 4) & mask;
+  uint32_t val = ok_get_bytes(h->regs, OK_HART_VALUE, 4) & mask;
+  uint32_t result = 0;
+  uint8_t ok = 0;
+
+  switch (ctrl & 0x0f) {
+    case OK_HART_CAS:
+    case OK_HART_FETCH_ADD:
+      if (addr >= OK_MEM_SIZE || (addr & 7) + width > 8) break;
+      ok = (uint8_t) ok_harts_rmw(g, addr, width, ctrl & 0x0f, arg, val,
+        &result);
+      break;
+    case OK_HART_SPAWN: {
+      pthread_mutex_lock(&g->lock);
+      int id = ok_harts_start(g, addr, width, arg);
+      pthread_mutex_unlock(&g->lock);
+      ok = id >= 0;
+      result = ok ? (uint32_t) id : mask;
+      break;
+    }
+    case OK_HART_JOIN: {
+      OkStatus status;
+      ok = (uint8_t) ok_harts_reap(g, (int) arg, &status);
+      if (ok) result = status;
+      break;
+    }
+  }
+
+  ok_set_bytes(h->regs, OK_HART_VALUE, 4, result);
+  h->regs[OK_HART_FLAG] = ok;
+}
+
+uint8_t ok_harts_read(OkHarts* g, size_t offset) {
+  OkHart* h = ok_hart_self;
+  if (!h || h->group != g || offset >= OK_HART_SIZE) return 0;
+  if (offset == OK_HART_CTRL) return (uint8_t) (h - g->harts);
+  return h->regs[offset];
+}
+
+void ok_harts_write(OkHarts* g, size_t offset, uint8_t val) {
+  OkHart* h = ok_hart_self;
+  if (!h || h->group != g || offset >= OK_HART_SIZE) return;
+  h->regs[offset] = val;
+  if (offset == OK_HART_CTRL) ok_harts_exec(g, h, val);
+}
+
+#endif // OK_IMPLEMENTATION
+
+#endif // OK_HART_H
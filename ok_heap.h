@@ -0,0 +1,313 @@
+#ifndef OK_HEAP_H
+#define OK_HEAP_H
+
+#include "ok.h"
+
+// host-managed heap
+//
+// Allocating in guest code costs hundreds of instructions per call, so
+// OkHeap does it on the host instead: it hands out blocks of a region of
+// guest RAM, [base, base + size), while all of its bookkeeping stays in host
+// memory, where a guest can't corrupt it. It is a buddy allocator: block
+// sizes are powers of two from OK_HEAP_MIN bytes up, free blocks sit in one
+// free list per size, and a freed block merges with its buddy right away, so
+// freeing everything always gets the whole region back in one piece.
+//
+// Guests use it through a register window an emulator exposes by routing
+// accesses to OK_HEAP_BASE to ok_heap_read and ok_heap_write. Registers are
+// big-endian:
+// - SIZE (word): bytes wanted
+// - PTR (word): the block to free or resize
+// - OP (1 byte): writing it runs an operation right away
+// - STATUS (1 byte): 0 on success, 1 if out of memory, PTR isn't a block
+//   (e.g. one freed already), or the operation is unknown
+// - RESULT (word): the block allocated or resized, or 0 on failure
+// Blocks are aligned to OK_HEAP_MIN bytes from base. Address 0 means no
+// block, like NULL, so base can't be 0.
+
+#ifndef OK_HEAP_BASE
+#define OK_HEAP_BASE (0xffff40) // address of the register window
+#endif
+
+#ifndef OK_HEAP_MIN
+#define OK_HEAP_MIN (16) // smallest block in bytes, a power of two
+#endif
+
+#define OK_HEAP_ORDERS (25) // block sizes, OK_HEAP_MIN << 0 to << 24
+
+#define OK_HEAP_SIZE_REG (0)
+#define OK_HEAP_PTR (OK_HEAP_SIZE_REG + OK_WORD_SIZE)
+#define OK_HEAP_OP (OK_HEAP_PTR + OK_WORD_SIZE)
+#define OK_HEAP_STATUS (OK_HEAP_OP + 1)
+#define OK_HEAP_RESULT (OK_HEAP_STATUS + 1)
+#define OK_HEAP_SIZE (OK_HEAP_RESULT + OK_WORD_SIZE) // size of the window
+
+#define OK_HEAP_ALLOC (1) // RESULT = a new block of SIZE bytes
+#define OK_HEAP_FREE (2) // free PTR (a PTR of 0 does nothing)
+#define OK_HEAP_REALLOC (3) // RESULT = PTR resized to SIZE bytes, like realloc
+
+typedef struct {
+  uint64_t live; // bytes asked for by live allocations
+  uint64_t used; // bytes in allocated blocks, rounding included
+  uint64_t free; // bytes in free blocks
+  uint64_t largest; // bytes in the largest free block
+  double fragmentation; // 1 - largest / free: 0 when free space is one block
+  uint64_t allocs;
+  uint64_t frees;
+  uint64_t reallocs;
+  uint64_t moves; // reallocs that had to copy the block elsewhere
+  uint64_t failed; // operations that failed
+} OkHeapStats;
+
+typedef struct {
+  uint8_t* ram; // OK_MEM_SIZE bytes, for realloc's copies
+  size_t base;
+  size_t units; // OK_HEAP_MIN byte units in the region
+  uint8_t* tags; // per unit: 0, or the order + 1 of the block starting there
+  uint32_t* next; // free list links, or the size asked for if allocated
+  uint32_t* prev;
+  uint32_t heads[OK_HEAP_ORDERS]; // free lists
+  OkHeapStats stats; // free, largest and fragmentation kept by ok_heap_stats
+  uint8_t regs[OK_HEAP_SIZE];
+} OkHeap;
+
+// manage [base, base + size) of ram. Returns 1 on success, 0 on failure.
+int ok_heap_init(OkHeap* h, uint8_t* ram, size_t base, size_t size);
+
+// release the heap's bookkeeping
+void ok_heap_destroy(OkHeap* h);
+
+// the same operations for the host. ok_heap_alloc and ok_heap_realloc
+// return 0 on failure, and ok_heap_free returns 1 on success, 0 on failure.
+size_t ok_heap_alloc(OkHeap* h, size_t len);
+int ok_heap_free(OkHeap* h, size_t ptr);
+size_t ok_heap_realloc(OkHeap* h, size_t ptr, size_t len);
+
+// current statistics
+OkHeapStats ok_heap_stats(const OkHeap* h);
+
+// register window accessors, offset is relative to OK_HEAP_BASE
+uint8_t ok_heap_read(OkHeap* h, size_t offset);
+void ok_heap_write(OkHeap* h, size_t offset, uint8_t val);
+
+#ifdef OK_IMPLEMENTATION
+
+#include <stdlib.h>
+#include <string.h>
+
+#define OK_HEAP_NONE (UINT32_MAX)
+#define OK_HEAP_FREE_TAG (0x80) // tag bit for free blocks
+
+static void ok_heap_push(OkHeap* h, int k, uint32_t u) {
+  h->tags[u] = OK_HEAP_FREE_TAG | (k + 1);
+  h->prev[u] = OK_HEAP_NONE;
+  h->next[u] = h->heads[k];
+  if (h->heads[k] != OK_HEAP_NONE) h->prev[h->heads[k]] = u;
+  h->heads[k] = u;
+}
+
+static void ok_heap_unlink(OkHeap* h, int k, uint32_t u) {
+  if (h->prev[u] != OK_HEAP_NONE) h->next[h->prev[u]] = h->next[u];
+  else h->heads[k] = h->next[u];
+  if (h->next[u] != OK_HEAP_NONE) h->prev[h->next[u]] = h->prev[u];
+  h->tags[u] = 0;
+}
+
+// whether unit u starts a free block of order k
+static int ok_heap_is_free(const OkHeap* h, uint32_t u, int k) {
+  return u < h->units && h->tags[u] == (OK_HEAP_FREE_TAG | (k + 1));
+}
+
+int ok_heap_init(OkHeap* h, uint8_t* ram, size_t base, size_t size) {
+  size_t units = size / OK_HEAP_MIN;
+  if (base == 0 || units == 0 || base + size > OK_MEM_SIZE) return 0;
+
+  h->tags = calloc(units, 1);
+  h->next = malloc(units * sizeof(uint32_t));
+  h->prev = malloc(units * sizeof(uint32_t));
+  if (!h->tags || !h->next || !h->prev) {
+    free(h->tags);
+    free(h->next);
+    free(h->prev);
+    return 0;
+  }
+  h->ram = ram;
+  h->base = base;
+  h->units = units;
+  for (int k = 0; k < OK_HEAP_ORDERS; k++) h->heads[k] = OK_HEAP_NONE;
+  memset(&h->stats, 0, sizeof(h->stats));
+  memset(h->regs, 0, sizeof(h->regs));
+
+  // cover the region with the largest aligned blocks that fit
+  size_t u = 0;
+  while (u < units) {
+    int k = OK_HEAP_ORDERS - 1;
+    while (k > 0 && ((u & ((1ul << k) - 1)) != 0 || u + (1ul << k) > units)) {
+      k--;
+    }
+    ok_heap_push(h, k, (uint32_t) u);
+    u += 1ul << k;
+  }
+  return 1;
+}
+
+void ok_heap_destroy(OkHeap* h) {
+  free(h->tags);
+  free(h->next);
+  free(h->prev);
+  h->tags = NULL;
+  h->next = h->prev = NULL;
+}
+
+// smallest order holding len bytes
+static int ok_heap_order(size_t len) {
+  int k = 0;
+  while (k < OK_HEAP_ORDERS && ((size_t) OK_HEAP_MIN << k) < len) k++;
+  return k;
+}
+
+// unit of the allocated block at ptr, or OK_HEAP_NONE
+static uint32_t ok_heap_block(const OkHeap* h, size_t ptr) {
+  if (ptr < h->base) return OK_HEAP_NONE;
+  size_t u = (ptr - h->base) / OK_HEAP_MIN;
+  if ((ptr - h->base) % OK_HEAP_MIN != 0 || u >= h->units) return OK_HEAP_NONE;
+  uint8_t tag = h->tags[u];
+  return tag != 0 && !(tag & OK_HEAP_FREE_TAG) ? (uint32_t) u : OK_HEAP_NONE;
+}
+
+size_t ok_heap_alloc(OkHeap* h, size_t len) {
+  int k = ok_heap_order(len);
+  int j = k;
+  while (j < OK_HEAP_ORDERS && h->heads[j] == OK_HEAP_NONE) j++;
+  if (len == 0 || j == OK_HEAP_ORDERS) {
+    h->stats.failed++;
+    return 0;
+  }
+
+  // split the block found until it's the right size
+  uint32_t u = h->heads[j];
+  ok_heap_unlink(h, j, u);
+  while (j > k) {
+    j--;
+    ok_heap_push(h, j, u + (1u << j));
+  }
+  h->tags[u] = (uint8_t) (k + 1);
+  h->next[u] = (uint32_t) len;
+
+  h->stats.live += len;
+  h->stats.used += (uint64_t) OK_HEAP_MIN << k;
+  h->stats.allocs++;
+  return h->base + (size_t) u * OK_HEAP_MIN;
+}
+
+// free the block at unit u, merging it with free buddies
+static void ok_heap_release(OkHeap* h, uint32_t u) {
+  int k = h->tags[u] - 1;
+  h->stats.live -= h->next[u];
+  h->stats.used -= (uint64_t) OK_HEAP_MIN << k;
+  h->tags[u] = 0;
+
+  while (k + 1 < OK_HEAP_ORDERS) {
+    uint32_t buddy = u ^ (1u << k);
+    if (!ok_heap_is_free(h, buddy, k)) break;
+    ok_heap_unlink(h, k, buddy);
+    if (buddy < u) u = buddy;
+    k++;
+  }
+  ok_heap_push(h, k, u);
+}
+
+int ok_heap_free(OkHeap* h, size_t ptr) {
+  if (ptr == 0) return 1;
+  uint32_t u = ok_heap_block(h, ptr);
+  if (u == OK_HEAP_NONE) {
+    h->stats.failed++;
+    return 0;
+  }
+  ok_heap_release(h, u);
+  h->stats.frees++;
+  return 1;
+}
+
+size_t ok_heap_realloc(OkHeap* h, size_t ptr, size_t len) {
+  if (ptr == 0) return ok_heap_alloc(h, len);
+  uint32_t u = ok_heap_block(h, ptr);
+  if (u == OK_HEAP_NONE) {
+    h->stats.failed++;
+    return 0;
+  }
+  if (len == 0) {
+    ok_heap_free(h, ptr);
+    return 0;
+  }
+  h->stats.reallocs++;
+
+  int k = h->tags[u] - 1;
+  int want = ok_heap_order(len);
+
+  // grow in place if the buddies to the right are free
+  int fits = want < OK_HEAP_ORDERS;
+  for (int j = k; fits && j < want; j++) {
+    fits = (u & (1u << j)) == 0 && ok_heap_is_free(h, u + (1u << j), j);
+  }
+  if (fits) {
+    for (int j = k; j < want; j++) ok_heap_unlink(h, j, u + (1u << j));
+    // shrink in place, freeing the upper halves
+    for (int j = k; j > want; j--) ok_heap_push(h, j - 1, u + (1u << (j - 1)));
+    h->stats.live += len - (uint64_t) h->next[u];
+    h->stats.used += ((uint64_t) OK_HEAP_MIN << want)
+      - ((uint64_t) OK_HEAP_MIN << k);
+    h->tags[u] = (uint8_t) (want + 1);
+    h->next[u] = (uint32_t) len;
+    return ptr;
+  }
+
+  size_t moved = ok_heap_alloc(h, len);
+  if (moved == 0) return 0; // ok_heap_alloc counted the failure
+  h->stats.allocs--;
+  size_t keep = h->next[u] < len ? h->next[u] : len;
+  memcpy(h->ram + moved, h->ram + ptr, keep);
+  ok_heap_release(h, u);
+  h->stats.moves++;
+  return moved;
+}
+
+OkHeapStats ok_heap_stats(const OkHeap* h) {
+  OkHeapStats st = h->stats;
+  st.free = (uint64_t) h->units * OK_HEAP_MIN - st.used;
+  st.largest = 0;
+  for (int k = OK_HEAP_ORDERS - 1; k >= 0 && st.largest == 0; k--) {
+    if (h->heads[k] != OK_HEAP_NONE) st.largest = (uint64_t) OK_HEAP_MIN << k;
+  }
+  st.fragmentation = st.free ? 1.0 - (double) st.largest / st.free : 0.0;
+  return st;
+}
+
+static void ok_heap_run(OkHeap* h, uint8_t op) {
+  size_t len = ok_get_bytes(h->regs, OK_HEAP_SIZE_REG, OK_WORD_SIZE);
+  size_t ptr = ok_get_bytes(h->regs, OK_HEAP_PTR, OK_WORD_SIZE);
+  uint64_t failed = h->stats.failed;
+  size_t result = 0;
+
+  if (op == OK_HEAP_ALLOC) result = ok_heap_alloc(h, len);
+  else if (op == OK_HEAP_FREE) ok_heap_free(h, ptr);
+  else if (op == OK_HEAP_REALLOC) result = ok_heap_realloc(h, ptr, len);
+  else h->stats.failed++;
+
+  ok_set_bytes(h->regs, OK_HEAP_RESULT, OK_WORD_SIZE, (uint32_t) result);
+  h->regs[OK_HEAP_STATUS] = h->stats.failed != failed;
+}
+
+uint8_t ok_heap_read(OkHeap* h, size_t offset) {
+  return offset < OK_HEAP_SIZE ? h->regs[offset] : 0;
+}
+
+void ok_heap_write(OkHeap* h, size_t offset, uint8_t val) {
+  if (offset >= OK_HEAP_SIZE) return;
+  h->regs[offset] = val;
+  if (offset == OK_HEAP_OP) ok_heap_run(h, val);
+}
+
+#endif // OK_IMPLEMENTATION
+
+#endif // OK_HEAP_H
@@ -0,0 +1,328 @@
+#ifndef OK_HEAT_H
+#define OK_HEAT_H
+
+#include "ok.h"
+#include <stdio.h>
+
+// RAM and ROM access heatmap and working set tracker
+//
+// The emulator reports every RAM read and write and every ROM fetch (with
+// ok_heat_read, ok_heat_write and ok_heat_fetch, next to the real access),
+// and the tracker keeps per-page counts plus the instruction each page was
+// first touched at. Time is counted in instructions, by ok_heat_hook, an
+// instruction hook (see ok_hooks_add) that works under any engine.
+//
+// On top of that it keeps:
+// - the working set over time: how many distinct RAM and ROM pages were
+//   touched in each window of OkHeat.window instructions
+// - a sampled reuse distance estimate for RAM: every OkHeat.sample-th RAM
+//   access starts watching its page (OK_HEAT_WATCH pages at a time), and the
+//   next access to that page records how many other distinct pages were
+//   touched in between, in a log2 histogram. This is what decides whether a
+//   guest's accesses fit in a cache of a given number of pages. Each watch
+//   keeps its own set of the pages touched since it started, so the count
+//   is ready when the page comes back. A sample due while every slot is busy
+//   takes over the one watched longest, counted in OkHeat.unreused, so pages
+//   that are never touched again don't stop sampling
+//
+// ok_heat_write_pages exports the heatmap as CSV, one row per touched page,
+// and ok_heat_write_report a summary with the working set and reuse
+// distance histogram.
+
+#ifndef OK_HEAT_PAGE
+#define OK_HEAT_PAGE (4096) // page size in bytes, a power of two
+#endif
+
+#ifndef OK_HEAT_WATCH
+#define OK_HEAT_WATCH (8) // pages whose reuse is watched at once
+#endif
+
+#define OK_HEAT_PAGES (OK_MEM_SIZE / OK_HEAT_PAGE)
+#define OK_HEAT_BUCKETS (33) // reuse histogram: 0, then [2^(b-1), 2^b)
+
+typedef struct {
+  uint64_t reads;
+  uint64_t writes;
+  uint64_t fetches;
+  uint64_t first; // clock at first touch, UINT64_MAX if never touched
+  uint64_t window; // 1 + the last window it was touched in
+  uint8_t watched; // 1 + its watch slot, 0 if not watched
+} OkHeatPage;
+
+typedef struct {
+  uint32_t ram; // distinct RAM pages touched
+  uint32_t rom; // distinct ROM pages touched
+} OkHeatWindow;
+
+typedef struct {
+  size_t page; // SIZE_MAX if the slot is free
+  uint64_t since; // access number watching started at
+  uint32_t distinct; // other pages touched since
+  uint64_t seen[OK_HEAT_PAGES / 64]; // those pages, and the watched one
+} OkHeatWatch;
+
+typedef struct {
+  OkHeatPage* ram; // OK_HEAT_PAGES each
+  OkHeatPage* rom;
+  uint64_t clock; // instructions started
+  uint64_t accesses; // RAM accesses recorded
+
+  uint64_t window; // instructions per working set window
+  uint64_t window_end; // clock the current window ends at
+  OkHeatWindow current;
+  OkHeatWindow* windows; // finished windows
+  size_t nwindows;
+  size_t cap;
+
+  uint64_t sample; // RAM accesses between reuse samples
+  uint64_t countdown;
+  OkHeatWatch watch[OK_HEAT_WATCH];
+  int watching; // busy watch slots
+  uint64_t reuse[OK_HEAT_BUCKETS]; // reuse distance histogram, in pages
+  uint64_t unreused; // watches given up before their page came back
+} OkHeat;
+
+// set up a tracker with working set windows of window instructions (0 for
+// none). Returns 1 on success, 0 on failure.
+int ok_heat_init(OkHeat* h, uint64_t window);
+
+// release the tracker
+void ok_heat_free(OkHeat* h);
+
+// record an access
+void ok_heat_read(OkHeat* h, size_t address);
+void ok_heat_write(OkHeat* h, size_t address);
+void ok_heat_fetch(OkHeat* h, size_t address);
+
+// instruction hook advancing the clock, with the OkHeat as ctx
+void ok_heat_hook(void* ctx, OkState* s, uint8_t instr);
+
+// finish the current working set window early, e.g. at the end of a run
+void ok_heat_flush(OkHeat* h);
+
+// print the touched pages as CSV. Returns 1 on success, 0 on failure.
+int ok_heat_write_pages(const OkHeat* h, FILE* f);
+
+// print pages touched, the working set over time and the reuse distance
+// histogram. Returns 1 on success, 0 on failure.
+int ok_heat_write_report(const OkHeat* h, FILE* f);
+
+#ifdef OK_IMPLEMENTATION
+
+#include <stdlib.h>
+#include <string.h>
+
+static void ok_heat_reset(OkHeatPage* pages) {
+  for (size_t i = 0; i < OK_HEAT_PAGES; i++) {
+    OkHeatPage* pg = &pages[i];
+    pg->reads = pg->writes = pg->fetches = 0;
+    pg->first = UINT64_MAX;
+    pg->window = 0;
+    pg->watched = 0;
+  }
+}
+
+int ok_heat_init(OkHeat* h, uint64_t window) {
+  h->ram = malloc(sizeof(OkHeatPage) * OK_HEAT_PAGES);
+  h->rom = malloc(sizeof(OkHeatPage) * OK_HEAT_PAGES);
+  if (!h->ram || !h->rom) {
+    free(h->ram);
+    free(h->rom);
+    return 0;
+  }
+  ok_heat_reset(h->ram);
+  ok_heat_reset(h->rom);
+
+  h->clock = 0;
+  h->accesses = 0;
+  h->window = window;
+  h->window_end = window;
+  h->current.ram = h->current.rom = 0;
+  h->windows = NULL;
+  h->nwindows = 0;
+  h->cap = 0;
+  h->sample = 1009;
+  h->countdown = h->sample;
+  for (int i = 0; i < OK_HEAT_WATCH; i++) h->watch[i].page = SIZE_MAX;
+  h->watching = 0;
+  for (int i = 0; i < OK_HEAT_BUCKETS; i++) h->reuse[i] = 0;
+  h->unreused = 0;
+  return 1;
+}
+
+void ok_heat_free(OkHeat* h) {
+  free(h->ram);
+  free(h->rom);
+  free(h->windows);
+  h->ram = h->rom = NULL;
+  h->windows = NULL;
+}
+
+// count a touch of pg, returning whether it's the first in this window
+static int ok_heat_touch(OkHeat* h, OkHeatPage* pg) {
+  if (pg->first == UINT64_MAX) pg->first = h->clock;
+  if (pg->window == h->nwindows + 1) return 0;
+  pg->window = h->nwindows + 1;
+  return 1;
+}
+
+// stop watching a slot's page
+static void ok_heat_unwatch(OkHeat* h, OkHeatWatch* w) {
+  h->ram[w->page].watched = 0;
+  w->page = SIZE_MAX;
+  h->watching--;
+}
+
+// a watched page came back: record the distinct pages touched in between
+static void ok_heat_reused(OkHeat* h, OkHeatPage* pg) {
+  OkHeatWatch* w = &h->watch[pg->watched - 1];
+  int bucket = 0;
+  while (w->distinct >> bucket) bucket++;
+  h->reuse[bucket]++;
+  ok_heat_unwatch(h, w);
+}
+
+// add page to every watch that hasn't seen it yet
+static void ok_heat_seen(OkHeat* h, size_t page) {
+  uint64_t bit = (uint64_t) 1 << (page % 64);
+  for (int i = 0; i < OK_HEAT_WATCH; i++) {
+    OkHeatWatch* w = &h->watch[i];
+    if (w->page == SIZE_MAX || (w->seen[page / 64] & bit)) continue;
+    w->seen[page / 64] |= bit;
+    w->distinct++;
+  }
+}
+
+// start watching page, in a free slot or else the one watched longest
+static void ok_heat_watch(OkHeat* h, size_t page) {
+  OkHeatWatch* w = &h->watch[0];
+  for (int i = 0; i < OK_HEAT_WATCH; i++) {
+    OkHeatWatch* slot = &h->watch[i];
+    if (slot->page == SIZE_MAX) {
+      w = slot;
+      break;
+    }
+    if (slot->since < w->since) w = slot;
+  }
+  if (w->page != SIZE_MAX) {
+    ok_heat_unwatch(h, w);
+    h->unreused++;
+  }
+
+  w->page = page;
+  w->since = h->accesses;
+  w->distinct = 0;
+  memset(w->seen, 0, sizeof(w->seen));
+  w->seen[page / 64] |= (uint64_t) 1 << (page % 64);
+  h->ram[page].watched = (uint8_t) (w - h->watch + 1);
+  h->watching++;
+}
+
+static void ok_heat_ram(OkHeat* h, size_t address) {
+  size_t page = (address & (OK_MEM_SIZE - 1)) / OK_HEAT_PAGE;
+  OkHeatPage* pg = &h->ram[page];
+  h->current.ram += ok_heat_touch(h, pg);
+  h->accesses++;
+  if (pg->watched) ok_heat_reused(h, pg);
+  if (h->watching) ok_heat_seen(h, page);
+
+  if (h->sample == 0 || --h->countdown > 0) return;
+  h->countdown = h->sample;
+  if (!pg->watched) ok_heat_watch(h, page);
+}
+
+void ok_heat_read(OkHeat* h, size_t address) {
+  h->ram[(address & (OK_MEM_SIZE - 1)) / OK_HEAT_PAGE].reads++;
+  ok_heat_ram(h, address);
+}
+
+void ok_heat_write(OkHeat* h, size_t address) {
+  h->ram[(address & (OK_MEM_SIZE - 1)) / OK_HEAT_PAGE].writes++;
+  ok_heat_ram(h, address);
+}
+
+void ok_heat_fetch(OkHeat* h, size_t address) {
+  OkHeatPage* pg = &h->rom[(address & (OK_MEM_SIZE - 1)) / OK_HEAT_PAGE];
+  pg->fetches++;
+  h->current.rom += ok_heat_touch(h, pg);
+}
+
+void ok_heat_flush(OkHeat* h) {
+  if (h->nwindows == h->cap) {
+    size_t cap = h->cap ? h->cap * 2 : 64;
+    OkHeatWindow* grown = realloc(h->windows, cap * sizeof(OkHeatWindow));
+    if (!grown) return; // the window is lost, but counting goes on
+    h->windows = grown;
+    h->cap = cap;
+  }
+  h->windows[h->nwindows++] = h->current;
+  h->current.ram = h->current.rom = 0;
+  h->window_end = h->clock + h->window;
+}
+
+void ok_heat_hook(void* ctx, OkState* s, uint8_t instr) {
+  OkHeat* h = ctx;
+  (void) s;
+  (void) instr;
+  if (h->window && h->clock >= h->window_end) ok_heat_flush(h);
+  h->clock++;
+}
+
+static int ok_heat_write_space(const OkHeatPage* pages, const char* space,
+                               FILE* f) {
+  for (size_t i = 0; i < OK_HEAT_PAGES; i++) {
+    const OkHeatPage* pg = &pages[i];
+    if (pg->first == UINT64_MAX) continue;
+    fprintf(f, "%s,%zu,0x%06zx,%llu,%llu,%llu,%llu\n", space, i,
+      i * OK_HEAT_PAGE, (unsigned long long) pg->reads,
+      (unsigned long long) pg->writes, (unsigned long long) pg->fetches,
+      (unsigned long long) pg->first);
+  }
+  return !ferror(f);
+}
+
+int ok_heat_write_pages(const OkHeat* h, FILE* f) {
+  fprintf(f, "space,page,address,reads,writes,fetches,first\n");
+  return ok_heat_write_space(h->ram, "ram", f)
+    && ok_heat_write_space(h->rom, "rom", f);
+}
+
+static size_t ok_heat_touched(const OkHeatPage* pages) {
+  size_t n = 0;
+  for (size_t i = 0; i < OK_HEAT_PAGES; i++) n += pages[i].first != UINT64_MAX;
+  return n;
+}
+
+int ok_heat_write_report(const OkHeat* h, FILE* f) {
+  size_t ram = ok_heat_touched(h->ram), rom = ok_heat_touched(h->rom);
+  fprintf(f, "instructions: %llu\n", (unsigned long long) h->clock);
+  fprintf(f, "ram pages touched: %zu of %zu (%zu bytes)\n", ram,
+    (size_t) OK_HEAT_PAGES, ram * OK_HEAT_PAGE);
+  fprintf(f, "rom pages touched: %zu of %zu (%zu bytes)\n", rom,
+    (size_t) OK_HEAT_PAGES, rom * OK_HEAT_PAGE);
+
+  if (h->nwindows > 0) {
+    fprintf(f, "\nworking set per %llu instructions (window ram rom):\n",
+      (unsigned long long) h->window);
+    for (size_t i = 0; i < h->nwindows; i++) {
+      fprintf(f, "%zu %u %u\n", i, h->windows[i].ram, h->windows[i].rom);
+    }
+  }
+
+  fprintf(f, "\nram reuse distance in pages (range samples):\n");
+  for (int b = 0; b < OK_HEAT_BUCKETS; b++) {
+    if (h->reuse[b] == 0) continue;
+    if (b == 0) fprintf(f, "0 %llu\n", (unsigned long long) h->reuse[b]);
+    else fprintf(f, "%llu-%llu %llu\n", 1ull << (b - 1), (1ull << b) - 1,
+      (unsigned long long) h->reuse[b]);
+  }
+  if (h->unreused > 0) {
+    fprintf(f, "not reused while watched %llu\n",
+      (unsigned long long) h->unreused);
+  }
+  return !ferror(f);
+}
+
+#endif // OK_IMPLEMENTATION
+
+#endif // OK_HEAT_H
@@ -0,0 +1,116 @@
+#ifndef OK_MMAP_H
+#define OK_MMAP_H
+
+#include "ok.h"
+
+// host files as memory windows
+//
+// Instead of copying a file into RAM (or ROM), an emulator can map it over a
+// window of the buffer backing that address space, so the guest's `lod`s (or
+// `fet`s) read the file's pages straight out of the page cache. Pages are
+// loaded as the guest first touches them, so memory use follows what the
+// guest reads rather than the size of the file.
+//
+// For that the buffer must come from ok_map_alloc, which maps OK_MEM_SIZE
+// bytes of zeroed, page-aligned memory, and windows must start on a page
+// boundary. A window covers the file rounded up to whole pages (the bytes
+// past its end read 0), or as much of it as fits before the end of the
+// buffer. The file shouldn't shrink while it's mapped.
+//
+// A read-only window never changes the file: guest writes to it go to
+// private copies of the pages they touch. A read-write window writes through
+// to the file; ok_map_sync flushes the pages written so far, and unmapping
+// does too.
+
+typedef struct {
+  uint8_t* mem; // buffer the window is in
+  size_t address; // start of the window
+  size_t len; // bytes mapped, whole pages
+  size_t size; // bytes of the file in the window
+  int writable;
+} OkMap;
+
+// map OK_MEM_SIZE zeroed bytes to back RAM or ROM, or NULL on failure
+uint8_t* ok_map_alloc(void);
+
+// unmap a buffer from ok_map_alloc, and any windows in it
+void ok_map_release(uint8_t* mem);
+
+// map the file at path over mem starting at address, a multiple of the page
+// size, writing through to the file if writable is nonzero. Returns 1 on
+// success, 0 on failure.
+int ok_map_file(OkMap* m, uint8_t* mem, size_t address, const char* path,
+                int writable);
+
+// write a read-write window's changes back to its file. Returns 1 on
+// success, 0 on failure.
+int ok_map_sync(OkMap* m);
+
+// put zeroed memory back in place of the window, syncing it first. Returns
+// 1 on success, 0 on failure.
+int ok_map_unmap(OkMap* m);
+
+#ifdef OK_IMPLEMENTATION
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+uint8_t* ok_map_alloc(void) {
+  void* mem = mmap(NULL, OK_MEM_SIZE, PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return mem == MAP_FAILED ? NULL : (uint8_t*) mem;
+}
+
+void ok_map_release(uint8_t* mem) {
+  munmap(mem, OK_MEM_SIZE);
+}
+
+int ok_map_file(OkMap* m, uint8_t* mem, size_t address, const char* path,
+                int writable) {
+  size_t page = (size_t) sysconf(_SC_PAGESIZE);
+  if (address % page != 0 || address >= OK_MEM_SIZE) return 0;
+
+  int fd = open(path, writable ? O_RDWR : O_RDONLY);
+  if (fd < 0) return 0;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return 0;
+  }
+
+  size_t size = (size_t) st.st_size;
+  if (size > OK_MEM_SIZE - address) size = OK_MEM_SIZE - address;
+  size_t len = (size + page - 1) / page * page;
+
+  // the mapping replaces the pages of mem it covers in one go
+  void* at = mmap(mem + address, len, PROT_READ | PROT_WRITE,
+    (writable ? MAP_SHARED : MAP_PRIVATE) | MAP_FIXED, fd, 0);
+  close(fd); // the mapping keeps the file open
+  if (at == MAP_FAILED) return 0;
+
+  m->mem = mem;
+  m->address = address;
+  m->len = len;
+  m->size = size;
+  m->writable = writable;
+  return 1;
+}
+
+int ok_map_sync(OkMap* m) {
+  if (!m->writable) return 1;
+  return msync(m->mem + m->address, m->len, MS_SYNC) == 0;
+}
+
+int ok_map_unmap(OkMap* m) {
+  int ok = ok_map_sync(m);
+  void* at = mmap(m->mem + m->address, m->len, PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+  m->len = m->size = 0;
+  return at != MAP_FAILED && ok;
+}
+
+#endif // OK_IMPLEMENTATION
+
+#endif // OK_MMAP_H
@@ -0,0 +1,470 @@
+#ifndef OK_OPT_H
+#define OK_OPT_H
+
+#include "ok.h"
+
+// bytecode-to-bytecode ROM optimizer
+//
+// ok_opt decodes a ROM, recovers its control flow and emits an equivalent
+// ROM with peephole rewrites, constant folding, jump threading and dead code
+// removal applied. Shrinking code moves it, so every code address in the ROM
+// has to be found and relocated. The optimizer relies on the calling
+// convention our compilers emit to do that:
+//
+// - direct jumps are a `lit` immediately followed by a `jmp` of the same width
+// - calls are `lit ret; psh; lit target; jmp`, with the same width for each
+//   pair, and return to the instruction right after their `jmp`; a `lit`
+//   immediately followed by a `psh` anywhere else is taken for data that
+//   might look like a code address
+// - the only other jumps are returns, a `pop` immediately followed by a `jmp`
+// - the ROM is never read as data (there are no `fet` instructions)
+//
+// ROMs that break any of these are rejected rather than miscompiled. The
+// output computes the same results, but code addresses left on a stack hold
+// their relocated values, and stale bytes above the top of a stack may differ.
+
+typedef struct {
+  size_t in_bytes, out_bytes; // ROM sizes
+  size_t in_insns, out_insns; // instruction counts
+  size_t folded; // peephole rewrites and folded constants
+  size_t threaded; // jumps retargeted past other jumps
+  size_t dead; // unreachable instructions removed
+  const char* reason; // why the ROM was rejected, if it was
+} OkOptStats;
+
+// optimize len bytes of rom into out, which must hold at least len bytes.
+// Returns the optimized length, or 0 if the ROM can't be relocated safely,
+// in which case stats->reason says why. stats may be NULL.
+size_t ok_opt(const uint8_t* rom, size_t len, uint8_t* out, OkOptStats* stats);
+
+#ifdef OK_OPT_IMPLEMENTATION
+
+#include <stdlib.h>
+#include <string.h>
+
+// instruction flags
+#define OK_OPT_LEADER (1 << 0) // control may arrive here from elsewhere
+#define OK_OPT_DEAD (1 << 1) // removed from the output
+#define OK_OPT_CODE (1 << 2) // a lit whose immediate is a code address
+#define OK_OPT_LIVE (1 << 3) // reachable from the entry point
+
+// instruction byte decoding
+#define OK_OPT_OP(i) ((i) & 0x0f)
+#define OK_OPT_WIDTH(i) ((((i) >> 4) & 3) + 1)
+#define OK_OPT_SKIP(i) (((i) & 0x40) != 0)
+#define OK_OPT_HALT(i) (((i) & 0x80) == 0)
+#define OK_OPT_INSTR(op, w) ((uint8_t) (0x80 | (((w) - 1) << 4) | (op)))
+
+typedef struct {
+  uint8_t instr; // instruction byte
+  uint8_t flags;
+  uint32_t imm; // lit immediate
+  size_t addr; // address in the input ROM
+  size_t out; // address in the output ROM
+  size_t target; // jump target index, for OK_OPT_CODE lits
+} OkOptInsn;
+
+// true if insn is an unflagged instance of op
+static int ok_opt_is(const OkOptInsn* insn, uint8_t op) {
+  return !OK_OPT_HALT(insn->instr) && !OK_OPT_SKIP(insn->instr)
+    && OK_OPT_OP(insn->instr) == op;
+}
+
+// true if insn is a plain lit we are free to rewrite
+static int ok_opt_is_const(const OkOptInsn* insn) {
+  return ok_opt_is(insn, OK_LIT) && !(insn->flags & OK_OPT_CODE);
+}
+
+static uint32_t ok_opt_mask(uint8_t width) {
+  return width == 4 ? 0xffffffff : ((uint32_t) 1 << (8 * width)) - 1;
+}
+
+// index of the first surviving instruction at or after i, or n
+static size_t ok_opt_resolve(const OkOptInsn* in, size_t n, size_t i) {
+  while (i < n && (in[i].flags & OK_OPT_DEAD)) i++;
+  return i;
+}
+
+// index of the first surviving instruction after i, or n
+static size_t ok_opt_next(const OkOptInsn* in, size_t n, size_t i) {
+  return i < n ? ok_opt_resolve(in, n, i + 1) : n;
+}
+
+static void ok_opt_kill(OkOptInsn* insn) {
+  insn->flags |= OK_OPT_DEAD;
+}
+
+// recompute which surviving instructions control may jump or return to
+static void ok_opt_leaders(OkOptInsn* in, size_t n) {
+  for (size_t i = 0; i < n; i++) in[i].flags &= ~OK_OPT_LEADER;
+
+  size_t entry = ok_opt_resolve(in, n, 0);
+  if (entry < n) in[entry].flags |= OK_OPT_LEADER;
+
+  for (size_t i = 0; i < n; i++) {
+    if (in[i].flags & OK_OPT_DEAD) continue;
+    size_t t = n;
+    if (in[i].flags & OK_OPT_CODE) {
+      t = ok_opt_resolve(in, n, in[i].target);
+    } else if (!OK_OPT_HALT(in[i].instr) && OK_OPT_OP(in[i].instr) == OK_JMP) {
+      t = ok_opt_next(in, n, i); // fall-through of a conditional jump
+    }
+    if (t < n) in[t].flags |= OK_OPT_LEADER;
+  }
+}
+
+// mark everything reachable from the entry point, and kill the rest
+static size_t ok_opt_reach(OkOptInsn* in, size_t n) {
+  size_t* work = malloc(sizeof(size_t) * (n + 1));
+  if (!work) return 0;
+
+  size_t top = 0;
+  for (size_t i = 0; i < n; i++) in[i].flags &= ~OK_OPT_LIVE;
+
+  size_t entry = ok_opt_resolve(in, n, 0);
+  if (entry < n) {
+    in[entry].flags |= OK_OPT_LIVE;
+    work[top++] = entry;
+  }
+
+  while (top > 0) {
+    size_t i = work[--top];
+    size_t succ[2];
+    int nsucc = 0;
+
+    if (!OK_OPT_HALT(in[i].instr)) {
+      if (!ok_opt_is(&in[i], OK_JMP)) succ[nsucc++] = ok_opt_next(in, n, i);
+      if (in[i].flags & OK_OPT_CODE) {
+        succ[nsucc++] = ok_opt_resolve(in, n, in[i].target);
+      }
+    }
+
+    for (int k = 0; k < nsucc; k++) {
+      size_t s = succ[k];
+      if (s < n && !(in[s].flags & OK_OPT_LIVE)) {
+        in[s].flags |= OK_OPT_LIVE;
+        work[top++] = s;
+      }
+    }
+  }
+  free(work);
+
+  size_t dead = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (!(in[i].flags & (OK_OPT_DEAD | OK_OPT_LIVE))) {
+      ok_opt_kill(&in[i]);
+      dead++;
+    }
+  }
+  return dead;
+}
+
+// try the peephole rules on the window starting at i; returns nonzero if
+// anything was rewritten
+static int ok_opt_rewrite(OkOptInsn* in, size_t n, size_t i) {
+  size_t j = ok_opt_next(in, n, i);
+  if (j >= n || (in[j].flags & OK_OPT_LEADER)) j = n;
+  size_t k = ok_opt_next(in, n, j);
+  if (k >= n || (in[k].flags & OK_OPT_LEADER)) k = n;
+
+  OkOptInsn* a = &in[i];
+  OkOptInsn* b = j < n ? &in[j] : NULL;
+  OkOptInsn* c = k < n ? &in[k] : NULL;
+
+  // nop does nothing unless it pops a flag
+  if (ok_opt_is(a, OK_NOP)) {
+    ok_opt_kill(a);
+    return 1;
+  }
+  if (!b) return 0;
+
+  uint8_t w = OK_OPT_WIDTH(a->instr);
+  int same = OK_OPT_WIDTH(b->instr) == w;
+
+  // pairs that cancel out
+  if (same && ((ok_opt_is(a, OK_DUP) && ok_opt_is(b, OK_DRP))
+      || (ok_opt_is(a, OK_SWP) && ok_opt_is(b, OK_SWP))
+      || (ok_opt_is(a, OK_PSH) && ok_opt_is(b, OK_POP))
+      || (ok_opt_is(a, OK_POP) && ok_opt_is(b, OK_PSH))
+      || (ok_opt_is_const(a) && ok_opt_is(b, OK_DRP)))) {
+    ok_opt_kill(a);
+    ok_opt_kill(b);
+    return 1;
+  }
+
+  // identity elements: x+0, x^0, x&~0, x shifted by 0
+  if (ok_opt_is_const(a) && ((same && a->imm == 0
+      && (ok_opt_is(b, OK_ADD) || ok_opt_is(b, OK_XOR)))
+      || (same && a->imm == ok_opt_mask(w) && ok_opt_is(b, OK_AND))
+      || (w == 1 && a->imm == 0 && ok_opt_is(b, OK_SHF)))) {
+    ok_opt_kill(a);
+    ok_opt_kill(b);
+    return 1;
+  }
+
+  // constant folding of two lits and a binary operation
+  if (c && ok_opt_is_const(a) && ok_opt_is_const(b)) {
+    uint8_t cw = OK_OPT_WIDTH(c->instr);
+    uint32_t x = a->imm, y = b->imm;
+    int fold = 1;
+
+    if (same && cw == w && ok_opt_is(c, OK_ADD)) {
+      x = (x + y) & ok_opt_mask(w);
+    } else if (same && cw == w && ok_opt_is(c, OK_AND)) {
+      x = x & y;
+    } else if (same && cw == w && ok_opt_is(c, OK_XOR)) {
+      x = x ^ y;
+    } else if (OK_OPT_WIDTH(b->instr) == 1 && cw == w && ok_opt_is(c, OK_SHF)) {
+      x = ((x >> (y & 0x0f)) << ((y & 0xf0) >> 4)) & ok_opt_mask(w);
+    } else if (same && cw == w && ok_opt_is(c, OK_CMP)) {
+      x = x > y ? 1 : (x < y ? 255 : 0);
+      a->instr = OK_OPT_INSTR(OK_LIT, 1);
+    } else {
+      fold = 0;
+    }
+
+    if (fold) {
+      a->imm = x;
+      ok_opt_kill(b);
+      ok_opt_kill(c);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+// retarget jumps whose target is itself an unconditional jump, and drop
+// unconditional jumps to the next instruction
+static size_t ok_opt_thread(OkOptInsn* in, size_t n, size_t len) {
+  size_t threaded = 0;
+
+  for (size_t i = 0; i < n; i++) {
+    if ((in[i].flags & OK_OPT_DEAD) || !(in[i].flags & OK_OPT_CODE)) continue;
+    size_t j = ok_opt_next(in, n, i);
+    if (j >= n || OK_OPT_HALT(in[j].instr) || OK_OPT_OP(in[j].instr) != OK_JMP) {
+      continue;
+    }
+    uint8_t w = OK_OPT_WIDTH(in[i].instr);
+
+    // hop along chains of jumps, bounded in case of a cycle
+    for (int hops = 0; hops < 64; hops++) {
+      size_t t = ok_opt_resolve(in, n, in[i].target);
+      if (t >= n || !(in[t].flags & OK_OPT_CODE)) break;
+      size_t tj = ok_opt_next(in, n, t);
+      if (tj >= n || !ok_opt_is(&in[tj], OK_JMP)) break;
+      if (OK_OPT_WIDTH(in[tj].instr) != OK_OPT_WIDTH(in[t].instr)) break;
+
+      // the new target must still fit in this lit (output addresses only
+      // ever shrink, so checking the input address is enough)
+      size_t dest = ok_opt_resolve(in, n, in[t].target);
+      size_t where = dest < n ? in[dest].addr : len;
+      if (where > ok_opt_mask(w) || in[t].target == in[i].target) break;
+
+      in[i].target = in[t].target;
+      threaded++;
+    }
+
+    // an unconditional jump to the following instruction does nothing
+    if (ok_opt_is(&in[j], OK_JMP)
+        && ok_opt_resolve(in, n, in[i].target) == ok_opt_next(in, n, j)) {
+      ok_opt_kill(&in[i]);
+      ok_opt_kill(&in[j]);
+      threaded++;
+    }
+  }
+
+  return threaded;
+}
+
+// merge runs of adjacent lits into wider ones, saving a tick apiece
+static size_t ok_opt_merge(OkOptInsn* in, size_t n) {
+  size_t merged = 0;
+
+  for (size_t i = 0; i < n; i++) {
+    if ((in[i].flags & OK_OPT_DEAD) || !ok_opt_is_const(&in[i])) continue;
+    for (;;) {
+      size_t j = ok_opt_next(in, n, i);
+      if (j >= n || (in[j].flags & OK_OPT_LEADER) || !ok_opt_is_const(&in[j])) {
+        break;
+      }
+      uint8_t wi = OK_OPT_WIDTH(in[i].instr), wj = OK_OPT_WIDTH(in[j].instr);
+      if (wi + wj > 4) break;
+
+      in[i].imm = (in[i].imm << (8 * wj)) | in[j].imm;
+      in[i].instr = OK_OPT_INSTR(OK_LIT, wi + wj);
+      ok_opt_kill(&in[j]);
+      merged++;
+    }
+  }
+
+  return merged;
+}
+
+// true if the lit before the psh at i is a return address: the start of a
+// call sequence, returning right after its jmp
+static int ok_opt_is_call(const OkOptInsn* in, size_t n, size_t i) {
+  if (i == 0 || i + 2 >= n || !ok_opt_is(&in[i], OK_PSH)) return 0;
+  const OkOptInsn* ret = &in[i - 1];
+  const OkOptInsn* target = &in[i + 1];
+  const OkOptInsn* jmp = &in[i + 2];
+  return OK_OPT_WIDTH(ret->instr) == OK_OPT_WIDTH(in[i].instr)
+    && ok_opt_is(target, OK_LIT) && ok_opt_is(jmp, OK_JMP)
+    && OK_OPT_WIDTH(target->instr) == OK_OPT_WIDTH(jmp->instr)
+    && ret->imm == jmp->addr + 1;
+}
+
+// decode the ROM and find its code addresses; returns a reason on failure
+static const char* ok_opt_decode(const uint8_t* rom, size_t len,
+                                 OkOptInsn* in, size_t* count) {
+  size_t n = 0;
+
+  for (size_t a = 0; a < len; n++) {
+    OkOptInsn* insn = &in[n];
+    memset(insn, 0, sizeof(*insn));
+    insn->instr = rom[a];
+    insn->addr = a++;
+
+    if (OK_OPT_HALT(insn->instr)) continue;
+    if (OK_OPT_OP(insn->instr) == OK_FET) return "ROM is read as data by fet";
+    if (OK_OPT_OP(insn->instr) == OK_LIT) {
+      uint8_t w = OK_OPT_WIDTH(insn->instr);
+      if (a + w > len) return "truncated lit at end of ROM";
+      for (uint8_t i = 0; i < w; i++) insn->imm = (insn->imm << 8) | rom[a++];
+    }
+  }
+  *count = n;
+
+  for (size_t i = 0; i < n; i++) {
+    if (OK_OPT_HALT(in[i].instr)) continue;
+    uint8_t op = OK_OPT_OP(in[i].instr);
+    uint8_t w = OK_OPT_WIDTH(in[i].instr);
+    const OkOptInsn* prev = i > 0 ? &in[i - 1] : NULL;
+
+    if (op == OK_JMP) {
+      if (prev && ok_opt_is(prev, OK_LIT) && OK_OPT_WIDTH(prev->instr) == w) {
+        in[i - 1].flags |= OK_OPT_CODE;
+      } else if (!(prev && ok_opt_is(prev, OK_POP) && OK_OPT_WIDTH(prev->instr) == w)) {
+        return "indirect jump";
+      }
+    } else if (op == OK_PSH && prev && ok_opt_is(prev, OK_LIT)) {
+      // relocating a constant that only happens to match a code address
+      // would change it, so only calls are allowed
+      if (!ok_opt_is_call(in, n, i)) return "lit pushed outside a call";
+      in[i - 1].flags |= OK_OPT_CODE;
+    }
+  }
+
+  // resolve code addresses to instruction indices
+  for (size_t i = 0; i < n; i++) {
+    if (!(in[i].flags & OK_OPT_CODE)) continue;
+    size_t lo = 0, hi = n;
+    while (lo < hi) {
+      size_t mid = lo + (hi - lo) / 2;
+      if (in[mid].addr < in[i].imm) lo = mid + 1;
+      else hi = mid;
+    }
+    if (lo < n ? in[lo].addr != in[i].imm : in[i].imm != len) {
+      return "code address inside an instruction";
+    }
+    in[i].target = lo;
+  }
+
+  // a jump or call whose address may come from elsewhere can't be relocated
+  ok_opt_leaders(in, n);
+  for (size_t i = 1; i < n; i++) {
+    if ((in[i - 1].flags & OK_OPT_CODE) && (in[i].flags & OK_OPT_LEADER)) {
+      return "jump into a call or jump sequence";
+    }
+  }
+
+  return NULL;
+}
+
+size_t ok_opt(const uint8_t* rom, size_t len, uint8_t* out, OkOptStats* stats) {
+  OkOptStats local;
+  if (!stats) stats = &local;
+  memset(stats, 0, sizeof(*stats));
+  stats->in_bytes = len;
+
+  if (len == 0) {
+    stats->reason = "empty ROM";
+    return 0;
+  }
+
+  OkOptInsn* in = malloc(sizeof(OkOptInsn) * len);
+  if (!in) {
+    stats->reason = "out of memory";
+    return 0;
+  }
+
+  size_t n = 0;
+  stats->reason = ok_opt_decode(rom, len, in, &n);
+  stats->in_insns = n;
+  if (stats->reason) {
+    free(in);
+    return 0;
+  }
+
+  // rewrite until nothing changes
+  for (int changed = 1; changed;) {
+    changed = 0;
+
+    size_t dead = ok_opt_reach(in, n);
+    stats->dead += dead;
+    ok_opt_leaders(in, n);
+
+    for (size_t i = 0; i < n; i++) {
+      if (in[i].flags & OK_OPT_DEAD) continue;
+      uint8_t leader = in[i].flags & OK_OPT_LEADER;
+      if (!ok_opt_rewrite(in, n, i)) continue;
+      stats->folded++;
+      changed = 1;
+
+      // whatever jumped to a removed instruction now lands after it
+      size_t t = ok_opt_resolve(in, n, i);
+      if (leader && t < n) in[t].flags |= OK_OPT_LEADER;
+    }
+
+    size_t threaded = ok_opt_thread(in, n, len);
+    stats->threaded += threaded;
+    if (dead || threaded) changed = 1;
+  }
+  ok_opt_leaders(in, n);
+  stats->folded += ok_opt_merge(in, n);
+
+  // lay out the survivors, then patch in their relocated addresses
+  size_t end = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (in[i].flags & OK_OPT_DEAD) continue;
+    in[i].out = end;
+    end += 1;
+    if (!OK_OPT_HALT(in[i].instr) && OK_OPT_OP(in[i].instr) == OK_LIT) {
+      end += OK_OPT_WIDTH(in[i].instr);
+    }
+    stats->out_insns++;
+  }
+
+  size_t at = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (in[i].flags & OK_OPT_DEAD) continue;
+    out[at++] = in[i].instr;
+    if (OK_OPT_HALT(in[i].instr) || OK_OPT_OP(in[i].instr) != OK_LIT) continue;
+
+    uint32_t imm = in[i].imm;
+    if (in[i].flags & OK_OPT_CODE) {
+      size_t t = ok_opt_resolve(in, n, in[i].target);
+      imm = (uint32_t) (t < n ? in[t].out : end);
+    }
+    uint8_t w = OK_OPT_WIDTH(in[i].instr);
+    for (int b = w - 1; b >= 0; b--) out[at++] = (uint8_t) (imm >> (8 * b));
+  }
+
+  free(in);
+  stats->out_bytes = end;
+  return end;
+}
+
+#endif // OK_OPT_IMPLEMENTATION
+
+#endif // OK_OPT_H
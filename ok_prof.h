@@ -0,0 +1,299 @@
+#ifndef OK_PROF_H
+#define OK_PROF_H
+
+#include "ok.h"
+#include <stdio.h>
+#include <signal.h>
+
+// sampling profiler
+//
+// Instead of counting every instruction, the profiler looks at the VM every
+// so often and records where it is: the pc, plus the return addresses the
+// guest keeps on the return stack for calls. Samples with the same stack are
+// merged, and ok_prof_write prints them as folded stacks (one
+// "outer;inner;leaf count" line per stack) for flame graph tools.
+//
+// Samples are taken either every OkProf.interval instructions, or whenever a
+// SIGPROF timer set up by ok_prof_timer fires (only one profiler per process
+// can use the timer). ok_prof_run runs the VM in chunks up to the next
+// sample, through ok_run (so any hooks the VM has still run) or through the
+// run function of another engine with ok_prof_run_on, and tests the timer's
+// flag once per chunk of at most OK_PROF_BLOCK instructions. Nothing is
+// added per instruction; the stack walk happens at sample time.
+//
+// Where the return addresses are is up to the guest's calling convention,
+// described by an OkProfLayout: starting at the top of the return stack,
+// every frame is `stride` bytes, holding a `width` byte address `offset`
+// bytes below the frame's top. The default is frames made of one word-sized
+// `psh` of the return address each.
+//
+// Symbol names come from an optional map file, with one "address name" line
+// per symbol (address in hex, like nm prints it). Addresses resolve to the
+// closest symbol at or below them; anything else prints as a hex address.
+
+#ifndef OK_PROF_DEPTH
+#define OK_PROF_DEPTH (32) // deepest stack recorded, deeper frames are cut off
+#endif
+
+#ifndef OK_PROF_BLOCK
+#define OK_PROF_BLOCK (4096) // most instructions between timer flag tests
+#endif
+
+#ifndef OK_PROF_STACKS
+#define OK_PROF_STACKS (4096) // distinct stacks kept, a power of two
+#endif
+
+typedef struct {
+  uint8_t width; // bytes in a return address
+  uint8_t stride; // bytes in a frame
+  uint8_t offset; // bytes from the top of a frame to its return address
+} OkProfLayout;
+
+typedef struct {
+  uint64_t count; // samples with this stack
+  uint32_t depth; // 0 if unused
+  uint32_t pcs[OK_PROF_DEPTH]; // innermost (the pc) first
+} OkProfStack;
+
+typedef struct {
+  uint32_t address;
+  char* name;
+} OkProfSymbol;
+
+typedef struct {
+  OkProfLayout layout;
+  uint64_t interval; // instructions between samples, 0 to only use the timer
+  uint64_t countdown; // instructions until the next sample
+  uint64_t samples; // samples taken
+  uint64_t dropped; // samples lost to a full stack table
+  OkProfStack* stacks; // OK_PROF_STACKS of them
+  OkProfSymbol* symbols; // sorted by address
+  size_t nsymbols;
+} OkProf;
+
+// set up a profiler sampling every interval instructions (0 for none).
+// Returns 1 on success, 0 on failure.
+int ok_prof_init(OkProf* p, uint64_t interval);
+
+// release the profiler's samples and symbols
+void ok_prof_free(OkProf* p);
+
+// load symbol names from a map file. Returns 1 on success, 0 on failure.
+int ok_prof_load_symbols(OkProf* p, const char* path);
+
+// take samples every usec microseconds of CPU time, or stop if usec is 0.
+// Returns 1 on success, 0 on failure.
+int ok_prof_timer(long usec);
+
+// record a sample of s now
+void ok_prof_sample(OkProf* p, const OkState* s);
+
+// the timer's "take a sample" flag
+extern volatile sig_atomic_t ok_prof_pending;
+
+// an engine's run function: run s for at most max instructions, or until
+// it stops, returning how many ran
+typedef uint64_t (*OkProfEngine)(void* ctx, OkState* s, uint64_t max);
+
+// run s for at most max instructions, or until it stops, while profiling.
+// Returns how many instructions ran.
+uint64_t ok_prof_run(OkProf* p, OkState* s, uint64_t max);
+
+// the same, running s with run(ctx, ...)
+uint64_t ok_prof_run_on(OkProf* p, OkState* s, uint64_t max,
+                        OkProfEngine run, void* ctx);
+
+// print the samples as folded stacks. Returns 1 on success, 0 on failure.
+int ok_prof_write(const OkProf* p, FILE* f);
+
+#ifdef OK_IMPLEMENTATION
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+volatile sig_atomic_t ok_prof_pending = 0;
+
+int ok_prof_init(OkProf* p, uint64_t interval) {
+  p->layout.width = OK_WORD_SIZE;
+  p->layout.stride = OK_WORD_SIZE;
+  p->layout.offset = 0;
+  p->interval = interval;
+  p->countdown = interval;
+  p->samples = 0;
+  p->dropped = 0;
+  p->symbols = NULL;
+  p->nsymbols = 0;
+  p->stacks = calloc(OK_PROF_STACKS, sizeof(OkProfStack));
+  return p->stacks != NULL;
+}
+
+void ok_prof_free(OkProf* p) {
+  for (size_t i = 0; i < p->nsymbols; i++) free(p->symbols[i].name);
+  free(p->symbols);
+  free(p->stacks);
+  p->symbols = NULL;
+  p->nsymbols = 0;
+  p->stacks = NULL;
+}
+
+static int ok_prof_symbol_order(const void* a, const void* b) {
+  uint32_t x = ((const OkProfSymbol*) a)->address;
+  uint32_t y = ((const OkProfSymbol*) b)->address;
+  return (x > y) - (x < y);
+}
+
+int ok_prof_load_symbols(OkProf* p, const char* path) {
+  FILE* f = fopen(path, "r");
+  if (!f) return 0;
+
+  char line[256];
+  unsigned long address;
+  char name[200];
+  size_t cap = p->nsymbols;
+  int ok = 1;
+  while (fgets(line, sizeof(line), f)) {
+    if (sscanf(line, "%lx %199s", &address, name) != 2) continue;
+    if (p->nsymbols == cap) {
+      cap = cap ? cap * 2 : 64;
+      OkProfSymbol* grown = realloc(p->symbols, cap * sizeof(OkProfSymbol));
+      if (!grown) {
+        ok = 0;
+        break;
+      }
+      p->symbols = grown;
+    }
+    char* copy = malloc(strlen(name) + 1);
+    if (!copy) {
+      ok = 0;
+      break;
+    }
+    strcpy(copy, name);
+    p->symbols[p->nsymbols].address = (uint32_t) address;
+    p->symbols[p->nsymbols].name = copy;
+    p->nsymbols++;
+  }
+  fclose(f);
+
+  qsort(p->symbols, p->nsymbols, sizeof(OkProfSymbol), ok_prof_symbol_order);
+  return ok;
+}
+
+static void ok_prof_signal(int sig) {
+  (void) sig;
+  ok_prof_pending = 1;
+}
+
+int ok_prof_timer(long usec) {
+  struct itimerval t;
+  t.it_interval.tv_sec = usec / 1000000;
+  t.it_interval.tv_usec = usec % 1000000;
+  t.it_value = t.it_interval;
+
+  if (usec > 0) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = ok_prof_signal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGPROF, &sa, NULL) != 0) return 0;
+  }
+  if (setitimer(ITIMER_PROF, &t, NULL) != 0) return 0;
+  ok_prof_pending = 0;
+  return 1;
+}
+
+void ok_prof_sample(OkProf* p, const OkState* s) {
+  ok_prof_pending = 0;
+  p->countdown = p->interval;
+  p->samples++;
+
+  // walk the return stack, newest frame first
+  uint32_t pcs[OK_PROF_DEPTH];
+  uint32_t depth = 0;
+  const OkProfLayout* l = &p->layout;
+  pcs[depth++] = (uint32_t) s->pc;
+  if (l->stride > 0 && l->width > 0 && l->width <= 4
+      && l->offset + l->width <= l->stride) {
+    for (int top = s->r; top >= l->stride && depth < OK_PROF_DEPTH;
+         top -= l->stride) {
+      size_t at = top - l->offset - l->width;
+      pcs[depth++] = ok_get_bytes((uint8_t*) s->rst, at, l->width);
+    }
+  }
+
+  uint64_t h = 14695981039346656037ull;
+  for (uint32_t i = 0; i < depth; i++) h = (h ^ pcs[i]) * 1099511628211ull;
+
+  for (size_t i = 0; i < OK_PROF_STACKS; i++) {
+    OkProfStack* st = &p->stacks[(h + i) & (OK_PROF_STACKS - 1)];
+    if (st->depth == 0) {
+      st->depth = depth;
+      memcpy(st->pcs, pcs, depth * sizeof(uint32_t));
+    } else if (st->depth != depth
+               || memcmp(st->pcs, pcs, depth * sizeof(uint32_t)) != 0) {
+      continue;
+    }
+    st->count++;
+    return;
+  }
+  p->dropped++;
+}
+
+uint64_t ok_prof_run_on(OkProf* p, OkState* s, uint64_t max,
+                        OkProfEngine run, void* ctx) {
+  uint64_t n = 0;
+  while (s->status == OK_RUNNING && n < max) {
+    // run up to the next sample, or the next look at the timer's flag
+    uint64_t chunk = max - n;
+    if (chunk > OK_PROF_BLOCK) chunk = OK_PROF_BLOCK;
+    if (p->interval && p->countdown < chunk) chunk = p->countdown;
+    uint64_t ran = run ? run(ctx, s, chunk) : ok_run(s, chunk);
+    n += ran;
+    if (p->interval) p->countdown -= ran;
+
+    if ((p->interval && p->countdown == 0) || ok_prof_pending) {
+      ok_prof_sample(p, s);
+    }
+    if (ran < chunk) break; // stopped, or a hook stopped it
+  }
+  return n;
+}
+
+uint64_t ok_prof_run(OkProf* p, OkState* s, uint64_t max) {
+  return ok_prof_run_on(p, s, max, NULL, NULL);
+}
+
+// closest symbol at or below address, or NULL
+static const char* ok_prof_symbol(const OkProf* p, uint32_t address) {
+  size_t lo = 0, hi = p->nsymbols;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (p->symbols[mid].address <= address) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo > 0 ? p->symbols[lo - 1].name : NULL;
+}
+
+int ok_prof_write(const OkProf* p, FILE* f) {
+  for (size_t i = 0; i < OK_PROF_STACKS; i++) {
+    const OkProfStack* st = &p->stacks[i];
+    if (st->depth == 0) continue;
+
+    // outermost frame first; return addresses point just past their call
+    for (uint32_t k = st->depth; k-- > 0;) {
+      uint32_t address = st->pcs[k];
+      uint32_t site = k > 0 && address > 0 ? address - 1 : address;
+      const char* name = ok_prof_symbol(p, site);
+      if (name) fputs(name, f);
+      else fprintf(f, "0x%06x", address);
+      fputc(k > 0 ? ';' : ' ', f);
+    }
+    fprintf(f, "%llu\n", (unsigned long long) st->count);
+  }
+  return !ferror(f);
+}
+
+#endif // OK_IMPLEMENTATION
+
+#endif // OK_PROF_H
@@ -0,0 +1,175 @@
+#ifndef OK_REPLAY_H
+#define OK_REPLAY_H
+
+#include "ok.h"
+#include <stdio.h>
+
+// record and replay of host input
+//
+// A guest's run is fully decided by its ROM and by the values it reads from
+// outside of RAM: device registers, ports, anything an emulator's
+// ok_mem_read answers with something other than plain memory. Recording
+// logs each of those reads; replaying feeds the logged values back instead of
+// touching the devices, so a session can be rerun offline, as fast as the VM
+// goes, under any engine or profiler. Writes don't need logging, they follow
+// from the reads.
+//
+// In ok_mem_read, for addresses that aren't plain RAM:
+//
+//   if (rp.replaying) return ok_replay_next(&rp, address);
+//   uint8_t val = device_read(address);
+//   ok_replay_log(&rp, address, val);
+//   return val;
+//
+// Every read is stamped with OkReplay.clock, the number of instructions
+// started so far, kept by ok_replay_hook, an instruction hook (see
+// ok_hooks_add) that works under any engine, so a session recorded under one
+// can be replayed under another. On replay, a read at another address or at
+// another time than the one logged means the guest took a different path (or
+// the clock isn't kept); the replay is marked diverged and reads 0 from then
+// on. Clearing OkReplay.timed only checks addresses.
+//
+// The log is a header followed by one record per read: the clock delta
+// since the previous read and the zigzagged address delta, both as LEB128,
+// then the value. A device polled in a loop costs about 3 bytes per read.
+
+typedef struct {
+  FILE* log;
+  int replaying; // 1 when replaying, 0 when recording
+  int timed; // check timestamps on replay
+  int diverged; // the replay no longer matches the log
+  uint64_t clock; // instructions started
+  uint64_t last; // clock at the previous read
+  size_t address; // address of the previous read
+  uint64_t reads; // reads logged or replayed
+} OkReplay;
+
+// start recording to the log at path, replacing it. Returns 1 on success, 0
+// on failure.
+int ok_replay_record(OkReplay* r, const char* path);
+
+// start replaying the log at path. Returns 1 on success, 0 on failure.
+int ok_replay_open(OkReplay* r, const char* path);
+
+// close the log. Returns 1 on success (and, when replaying, if the replay
+// matched the log and used all of it), 0 on failure.
+int ok_replay_close(OkReplay* r);
+
+// log a value read from address
+void ok_replay_log(OkReplay* r, size_t address, uint8_t val);
+
+// the logged value of the next read, from address
+uint8_t ok_replay_next(OkReplay* r, size_t address);
+
+// instruction hook advancing the clock, with the OkReplay as ctx
+void ok_replay_hook(void* ctx, OkState* s, uint8_t instr);
+
+#ifdef OK_IMPLEMENTATION
+
+#define OK_REPLAY_MAGIC (0x4f4b5250) // "OKRP"
+
+static void ok_replay_reset(OkReplay* r, FILE* log, int replaying) {
+  r->log = log;
+  r->replaying = replaying;
+  r->timed = 1;
+  r->diverged = 0;
+  r->clock = 0;
+  r->last = 0;
+  r->address = 0;
+  r->reads = 0;
+}
+
+int ok_replay_record(OkReplay* r, const char* path) {
+  FILE* log = fopen(path, "wb");
+  if (!log) return 0;
+  uint8_t header[4];
+  ok_set_bytes(header, 0, 4, OK_REPLAY_MAGIC);
+  if (fwrite(header, 1, 4, log) != 4) {
+    fclose(log);
+    return 0;
+  }
+  ok_replay_reset(r, log, 0);
+  return 1;
+}
+
+int ok_replay_open(OkReplay* r, const char* path) {
+  FILE* log = fopen(path, "rb");
+  if (!log) return 0;
+  uint8_t header[4];
+  if (fread(header, 1, 4, log) != 4
+      || ok_get_bytes(header, 0, 4) != OK_REPLAY_MAGIC) {
+    fclose(log);
+    return 0;
+  }
+  ok_replay_reset(r, log, 1);
+  return 1;
+}
+
+int ok_replay_close(OkReplay* r) {
+  // a replay that stopped early left reads in the log
+  if (r->replaying && getc(r->log) != EOF) r->diverged = 1;
+  int ok = r->replaying ? !r->diverged : !ferror(r->log);
+  ok &= fclose(r->log) == 0;
+  r->log = NULL;
+  return ok;
+}
+
+static void ok_replay_put(FILE* log, uint64_t n) {
+  while (n >= 0x80) {
+    putc((int) (n & 0x7f) | 0x80, log);
+    n >>= 7;
+  }
+  putc((int) n, log);
+}
+
+// returns 0 at the end of the log, or if it's cut short
+static int ok_replay_get(FILE* log, uint64_t* n) {
+  *n = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    int byte = getc(log);
+    if (byte == EOF) return 0;
+    *n |= (uint64_t) (byte & 0x7f) << shift;
+    if (!(byte & 0x80)) return 1;
+  }
+  return 0;
+}
+
+void ok_replay_log(OkReplay* r, size_t address, uint8_t val) {
+  int64_t step = (int64_t) address - (int64_t) r->address;
+  ok_replay_put(r->log, r->clock - r->last);
+  ok_replay_put(r->log, ((uint64_t) step << 1) ^ (uint64_t) (step >> 63));
+  putc(val, r->log);
+  r->last = r->clock;
+  r->address = address;
+  r->reads++;
+}
+
+uint8_t ok_replay_next(OkReplay* r, size_t address) {
+  if (r->diverged) return 0;
+
+  uint64_t delta, zigzag;
+  int val = EOF;
+  if (ok_replay_get(r->log, &delta) && ok_replay_get(r->log, &zigzag)) {
+    val = getc(r->log);
+  }
+  int64_t step = (int64_t) (zigzag >> 1) ^ -(int64_t) (zigzag & 1);
+  r->last += delta;
+  r->address += (size_t) step;
+  if (val == EOF || r->address != address
+      || (r->timed && r->last != r->clock)) {
+    r->diverged = 1;
+    return 0;
+  }
+  r->reads++;
+  return (uint8_t) val;
+}
+
+void ok_replay_hook(void* ctx, OkState* s, uint8_t instr) {
+  (void) s;
+  (void) instr;
+  ((OkReplay*) ctx)->clock++;
+}
+
+#endif // OK_IMPLEMENTATION
+
+#endif // OK_REPLAY_H
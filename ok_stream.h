@@ -0,0 +1,263 @@
+#ifndef OK_STREAM_H
+#define OK_STREAM_H
+
+#include "ok.h"
+
+// buffered console and stream devices
+//
+// OkOutBuf and OkInBuf buffer output to and input from any file descriptor,
+// so a guest printing or reading a byte at a time doesn't cost a syscall per
+// byte. Output is flushed when the buffer fills, on ok_out_flush (call it
+// when the VM halts), and on every newline if the buffer is line buffered.
+//
+// OkStream puts one of each behind a register window an emulator exposes by
+// routing accesses to OK_STREAM_BASE to ok_stream_read and ok_stream_write.
+// The window sits with the other devices' at the top of memory, so it never
+// shadows RAM a guest uses. Emulators may also route just the writes to
+// OK_STREAM_CONSOLE, the console address the examples have always used, to
+// OUT, leaving reads of it and of the bytes around it to RAM.
+// Registers (words are big-endian):
+// - OUT (1 byte): writing outputs a byte
+// - IN (1 byte): reading takes the next input byte, or 0 at end of input
+// - STATUS (1 byte): reading waits until input is available, then gives
+//   OK_STREAM_READY, or OK_STREAM_EOF at end of input. Writing anything
+//   drains the ring and flushes output
+// - RING, RING_SIZE (words): a ring buffer in guest RAM for bulk output
+// - HEAD (word): how many bytes the guest has put in the ring so far,
+//   wrapping around at the word size; the byte for count n goes at
+//   RING + n % RING_SIZE. Writing HEAD's first byte (the last one `str`
+//   writes) publishes it
+// - TAIL (word, read only): how many bytes the host has taken out. The
+//   guest may fill the ring up to RING_SIZE bytes ahead of TAIL
+// The host drains the ring in bulk, once it is half full when HEAD is
+// published, on writes to STATUS, and on ok_stream_flush.
+
+#ifndef OK_STREAM_BUF
+#define OK_STREAM_BUF (4096) // bytes buffered each way
+#endif
+
+#ifndef OK_STREAM_BASE
+#define OK_STREAM_BASE (0xffffc0) // address of the register window
+#endif
+
+#ifndef OK_STREAM_CONSOLE
+#define OK_STREAM_CONSOLE (0x00babe) // write-only port for OUT
+#endif
+
+// register offsets
+#define OK_STREAM_OUT (0)
+#define OK_STREAM_IN (1)
+#define OK_STREAM_STATUS (2)
+#define OK_STREAM_RING (3)
+#define OK_STREAM_RING_SIZE (OK_STREAM_RING + OK_WORD_SIZE)
+#define OK_STREAM_HEAD (OK_STREAM_RING_SIZE + OK_WORD_SIZE)
+#define OK_STREAM_TAIL (OK_STREAM_HEAD + OK_WORD_SIZE)
+#define OK_STREAM_SIZE (OK_STREAM_TAIL + OK_WORD_SIZE) // size of the window
+
+// STATUS bits
+#define OK_STREAM_READY (1)
+#define OK_STREAM_EOF (2)
+
+typedef struct {
+  int fd;
+  int line; // flush on every newline
+  size_t len; // bytes waiting in buf
+  uint8_t buf[OK_STREAM_BUF];
+} OkOutBuf;
+
+typedef struct {
+  int fd;
+  int eof;
+  size_t pos; // next byte of buf to hand out
+  size_t len; // bytes read into buf
+  uint8_t buf[OK_STREAM_BUF];
+} OkInBuf;
+
+typedef struct {
+  uint8_t* ram; // OK_MEM_SIZE bytes, for the ring
+  OkOutBuf out;
+  OkInBuf in;
+  size_t tail;
+  uint8_t regs[OK_STREAM_SIZE];
+} OkStream;
+
+void ok_out_init(OkOutBuf* o, int fd, int line);
+
+// write everything buffered. Returns 1 on success, 0 on failure.
+int ok_out_flush(OkOutBuf* o);
+
+// buffer n bytes, writing large runs straight through. Returns 1 on
+// success, 0 on failure.
+int ok_out_write(OkOutBuf* o, const uint8_t* bytes, size_t n);
+
+// buffer a byte
+static inline void ok_out_put(OkOutBuf* o, uint8_t byte) {
+  o->buf[o->len++] = byte;
+  if (o->len == OK_STREAM_BUF || (o->line && byte == '\n')) ok_out_flush(o);
+}
+
+void ok_in_init(OkInBuf* i, int fd);
+
+// whether a byte is available, reading ahead (and waiting) if the buffer is
+// empty. Returns 0 at end of input.
+int ok_in_ready(OkInBuf* i);
+
+// the next byte, or -1 at end of input
+static inline int ok_in_get(OkInBuf* i) {
+  if (i->pos == i->len && !ok_in_ready(i)) return -1;
+  return i->buf[i->pos++];
+}
+
+// set up a stream device reading in_fd and writing out_fd, with its ring
+// in ram. Output is line buffered if line is nonzero.
+void ok_stream_init(OkStream* st, uint8_t* ram, int in_fd, int out_fd,
+                    int line);
+
+// register window accessors, offset is relative to OK_STREAM_BASE
+uint8_t ok_stream_read(OkStream* st, size_t offset);
+void ok_stream_write(OkStream* st, size_t offset, uint8_t val);
+
+// drain the ring and flush output, e.g. once the VM halts. Returns 1 on
+// success, 0 on failure.
+int ok_stream_flush(OkStream* st);
+
+#ifdef OK_IMPLEMENTATION
+
+#include <errno.h>
+#include <unistd.h>
+
+// write all of bytes, retrying short writes and interruptions
+static int ok_stream_write_all(int fd, const uint8_t* bytes, size_t n) {
+  while (n > 0) {
+    ssize_t done = write(fd, bytes, n);
+    if (done < 0 && errno == EINTR) continue;
+    if (done <= 0) return 0;
+    bytes += done;
+    n -= (size_t) done;
+  }
+  return 1;
+}
+
+void ok_out_init(OkOutBuf* o, int fd, int line) {
+  o->fd = fd;
+  o->line = line;
+  o->len = 0;
+}
+
+int ok_out_flush(OkOutBuf* o) {
+  int ok = ok_stream_write_all(o->fd, o->buf, o->len);
+  o->len = 0;
+  return ok;
+}
+
+int ok_out_write(OkOutBuf* o, const uint8_t* bytes, size_t n) {
+  if (n >= OK_STREAM_BUF) {
+    return ok_out_flush(o) && ok_stream_write_all(o->fd, bytes, n);
+  }
+
+  int ok = 1;
+  for (size_t i = 0; i < n; i++) {
+    o->buf[o->len++] = bytes[i];
+    if (o->len == OK_STREAM_BUF || (o->line && bytes[i] == '\n')) {
+      ok &= ok_out_flush(o);
+    }
+  }
+  return ok;
+}
+
+void ok_in_init(OkInBuf* i, int fd) {
+  i->fd = fd;
+  i->eof = 0;
+  i->pos = 0;
+  i->len = 0;
+}
+
+int ok_in_ready(OkInBuf* i) {
+  while (i->pos == i->len && !i->eof) {
+    ssize_t got = read(i->fd, i->buf, OK_STREAM_BUF);
+    if (got < 0 && errno == EINTR) continue;
+    if (got <= 0) {
+      i->eof = 1;
+      break;
+    }
+    i->pos = 0;
+    i->len = (size_t) got;
+  }
+  return i->pos < i->len;
+}
+
+void ok_stream_init(OkStream* st, uint8_t* ram, int in_fd, int out_fd,
+                    int line) {
+  st->ram = ram;
+  ok_out_init(&st->out, out_fd, line);
+  ok_in_init(&st->in, in_fd);
+  st->tail = 0;
+  for (int i = 0; i < OK_STREAM_SIZE; i++) st->regs[i] = 0;
+}
+
+// HEAD and TAIL wrap around at the word size
+#define OK_STREAM_MASK ((size_t) (0xffffffffu >> (8 * (4 - OK_WORD_SIZE))))
+
+// move the bytes between TAIL and HEAD from the ring to output
+static int ok_stream_drain(OkStream* st) {
+  size_t ring = ok_get_bytes(st->regs, OK_STREAM_RING, OK_WORD_SIZE);
+  size_t size = ok_get_bytes(st->regs, OK_STREAM_RING_SIZE, OK_WORD_SIZE);
+  size_t head = ok_get_bytes(st->regs, OK_STREAM_HEAD, OK_WORD_SIZE);
+  size_t pending = (head - st->tail) & OK_STREAM_MASK;
+  if (size == 0 || pending == 0 || pending > size) return pending == 0;
+
+  // usually one or two runs, split where the ring (or RAM) wraps around
+  int ok = 1;
+  while (pending > 0) {
+    size_t at = st->tail % size;
+    size_t run = size - at < pending ? size - at : pending;
+    size_t start = (ring + at) & (OK_MEM_SIZE - 1);
+    if (start + run > OK_MEM_SIZE) run = OK_MEM_SIZE - start;
+    ok &= ok_out_write(&st->out, st->ram + start, run);
+    st->tail = (st->tail + run) & OK_STREAM_MASK;
+    pending -= run;
+  }
+  ok_set_bytes(st->regs, OK_STREAM_TAIL, OK_WORD_SIZE, (uint32_t) st->tail);
+  return ok;
+}
+
+int ok_stream_flush(OkStream* st) {
+  int ok = ok_stream_drain(st);
+  return ok_out_flush(&st->out) && ok;
+}
+
+uint8_t ok_stream_read(OkStream* st, size_t offset) {
+  switch (offset) {
+    case OK_STREAM_IN: {
+      int byte = ok_in_get(&st->in);
+      return byte < 0 ? 0 : (uint8_t) byte;
+    }
+    case OK_STREAM_STATUS:
+      return ok_in_ready(&st->in) ? OK_STREAM_READY : OK_STREAM_EOF;
+  }
+  return offset < OK_STREAM_SIZE ? st->regs[offset] : 0;
+}
+
+void ok_stream_write(OkStream* st, size_t offset, uint8_t val) {
+  switch (offset) {
+    case OK_STREAM_OUT:
+      ok_out_put(&st->out, val);
+      return;
+    case OK_STREAM_STATUS:
+      ok_stream_flush(st);
+      return;
+    case OK_STREAM_HEAD: {
+      st->regs[offset] = val;
+      size_t size = ok_get_bytes(st->regs, OK_STREAM_RING_SIZE, OK_WORD_SIZE);
+      size_t head = ok_get_bytes(st->regs, OK_STREAM_HEAD, OK_WORD_SIZE);
+      size_t pending = (head - st->tail) & OK_STREAM_MASK;
+      if (pending * 2 >= size) ok_stream_drain(st);
+      return;
+    }
+  }
+  if (offset < OK_STREAM_TAIL) st->regs[offset] = val;
+}
+
+#endif // OK_IMPLEMENTATION
+
+#endif // OK_STREAM_H
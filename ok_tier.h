@@ -0,0 +1,191 @@
+#ifndef OK_TIER_H
+#define OK_TIER_H
+
+#include "ok_code.h"
+
+// tiered execution
+//
+// Decoding a ROM (see ok_code.h) makes running it faster, but costs time up
+// front that short-lived guests never win back. OkTier starts every guest
+// in the plain interpreter, ok_tick, and counts how often each jump lands
+// where it does. Once a target has been jumped to OkTier.threshold times,
+// it's hot: the ROM is decoded then (only once, on the first promotion),
+// and from then on, execution reaching a hot target carries on from the
+// decoded code, a block at a time like ok_code_run. Only the target of the
+// jump ending a block is checked, and the code stays there until one lands
+// somewhere cold, which is counted the same way, and drops back to the
+// interpreter.
+//
+// Both tiers work on the same OkState, switching between instructions, so
+// the state is always exactly what ok_tick alone would have left. Counters
+// are kept per hash of the target, so a collision can only promote a target
+// early. A threshold of 0 promotes the first target jumped to, and
+// UINT32_MAX never promotes anything.
+
+#ifndef OK_TIER_THRESHOLD
+#define OK_TIER_THRESHOLD (50) // default jumps to a target before it's hot
+#endif
+
+#ifndef OK_TIER_COUNTERS
+#define OK_TIER_COUNTERS (4096) // hotness counters, a power of two
+#endif
+
+typedef struct {
+  uint64_t interpreted; // instructions run by ok_tick
+  uint64_t decoded; // instructions run from decoded code
+  uint64_t promotions; // targets found hot
+  uint64_t enters; // switches from the interpreter to decoded code
+  uint64_t exits; // switches back
+} OkTierStats;
+
+typedef struct {
+  const uint8_t* rom;
+  size_t len;
+  uint32_t threshold;
+  uint32_t counts[OK_TIER_COUNTERS];
+  OkCode* code; // NULL until the first promotion
+  uint64_t* hot; // one bit per address the code covers
+  size_t covered; // addresses the code covers, 0 before it's built
+  OkTierStats stats;
+} OkTier;
+
+// set up tiering for a ROM of len bytes, the one ok_fetch reads, which must
+// stay unchanged while in use. Nothing is allocated until the first
+// promotion. Returns 1 on success, 0 on failure.
+int ok_tier_init(OkTier* t, const uint8_t* rom, size_t len,
+                 uint32_t threshold);
+
+// release the counters and decoded code
+void ok_tier_free(OkTier* t);
+
+// run s for at most max instructions, or until it stops. Returns how many
+// instructions ran.
+uint64_t ok_tier_run(OkTier* t, OkState* s, uint64_t max);
+
+#ifdef OK_IMPLEMENTATION
+
+int ok_tier_init(OkTier* t, const uint8_t* rom, size_t len,
+                 uint32_t threshold) {
+  t->rom = rom;
+  t->len = len;
+  t->threshold = threshold;
+  memset(t->counts, 0, sizeof(t->counts));
+  memset(&t->stats, 0, sizeof(t->stats));
+  t->code = NULL;
+  t->hot = NULL;
+  t->covered = 0;
+  return 1;
+}
+
+void ok_tier_free(OkTier* t) {
+  free(t->hot);
+  ok_code_free(t->code);
+  t->hot = NULL;
+  t->code = NULL;
+  t->covered = 0;
+}
+
+static inline int ok_tier_is_hot(const OkTier* t, size_t pc) {
+  return pc < t->covered && (t->hot[pc / 64] >> (pc % 64) & 1);
+}
+
+// count a jump landing at pc, promoting it once it's hot
+static void ok_tier_count(OkTier* t, size_t pc) {
+  if (pc >= t->len || t->threshold == UINT32_MAX || ok_tier_is_hot(t, pc)) {
+    return;
+  }
+  uint32_t* count = &t->counts[(pc * 0x9e3779b1u) % OK_TIER_COUNTERS];
+  if (*count < t->threshold) {
+    (*count)++;
+    return;
+  }
+
+  if (!t->code) {
+    t->code = ok_code_build(t->rom, t->len);
+    t->hot = t->code ? calloc(t->code->len / 64 + 1, sizeof(uint64_t)) : NULL;
+    if (!t->hot) {
+      ok_code_free(t->code);
+      t->code = NULL;
+      t->threshold = UINT32_MAX; // can't decode, so stay interpreted
+      return;
+    }
+    t->covered = t->code->len;
+  }
+  if (pc >= t->covered) return; // past the end of the code, so a halt
+  t->hot[pc / 64] |= (uint64_t) 1 << (pc % 64);
+  t->stats.promotions++;
+}
+
+static inline int ok_tier_is_jmp(uint8_t instr) {
+  return (instr & 0x8f) == (0x80 | OK_JMP);
+}
+
+// run interpreted until reaching a hot target
+static uint64_t ok_tier_interpret(OkTier* t, OkState* s, uint64_t max) {
+  uint64_t n = 0;
+  while (s->status == OK_RUNNING && n < max && !ok_tier_is_hot(t, s->pc)) {
+    uint8_t instr = s->pc < t->len ? t->rom[s->pc] : 0;
+    if (!ok_run(s, 1)) break;
+    n++;
+    if (ok_tier_is_jmp(instr)) ok_tier_count(t, s->pc);
+  }
+  t->stats.interpreted += n;
+  return n;
+}
+
+// where a jump from decoded code landed; returns 0 if it's cold
+static inline int ok_tier_landed(OkTier* t, size_t pc) {
+  if (ok_tier_is_hot(t, pc)) return 1;
+  ok_tier_count(t, pc);
+  if (ok_tier_is_hot(t, pc)) return 1;
+  t->stats.exits++;
+  return 0;
+}
+
+// run decoded code until a jump lands somewhere cold
+static uint64_t ok_tier_decoded(OkTier* t, OkState* s, uint64_t max) {
+  const OkCode* c = t->code;
+  uint64_t n = 0;
+  t->stats.enters++;
+
+  // hooks need calling before every instruction
+  if (s->hooks) {
+    while (s->status == OK_RUNNING && n < max) {
+      size_t pc = s->pc;
+      int jmp = pc < c->len && ok_tier_is_jmp(c->insns[pc].instr);
+      if (!ok_code_step(c, s)) break;
+      n++;
+      if (jmp && !ok_tier_landed(t, s->pc)) break;
+    }
+    t->stats.decoded += n;
+    return n;
+  }
+
+  while (s->status == OK_RUNNING && n < max) {
+    uint32_t run = s->pc < c->len ? c->insns[s->pc].run : 0;
+    if (run == 0) {
+      ok_tick(s); // past the code or a partial `lit`, neither a jump
+      n++;
+      continue;
+    }
+    if (run > max - n) run = (uint32_t) (max - n);
+    uint8_t last = ok_code_block(c, s, run);
+    n += run;
+    if (ok_tier_is_jmp(last) && !ok_tier_landed(t, s->pc)) break;
+  }
+  t->stats.decoded += n;
+  return n;
+}
+
+uint64_t ok_tier_run(OkTier* t, OkState* s, uint64_t max) {
+  uint64_t n = 0;
+  while (s->status == OK_RUNNING && n < max) {
+    n += ok_tier_interpret(t, s, max - n);
+    if (s->status == OK_RUNNING && n < max) n += ok_tier_decoded(t, s, max - n);
+  }
+  return n;
+}
+
+#endif // OK_IMPLEMENTATION
+
+#endif // OK_TIER_H
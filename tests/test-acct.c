@@ -0,0 +1,138 @@
+#define OK_IMPLEMENTATION
+#define OK_ACCOUNTING
+#include "../ok_acct.h"
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// instruction defines go here
+#define LIT1 (0b10001101)
+#define LIT3 (0b10101101)
+#define ADD1 (0b10000000)
+#define CMP1 (0b10000101)
+#define LOD1 (0b10000111)
+#define DRP1 (0b10001001)
+#define DUP1 (0b10001000)
+#define JMP3_SKIP (0b11101100)
+
+#define PORT (0xfffff0) // a slow device
+
+// program mem goes here
+static uint8_t program[] = {
+  // 100 times: read RAM[0x100] and PORT
+  LIT1, 0,
+  LIT3, 0x00, 0x01, 0x00, LOD1, DRP1, // 2
+  LIT3, 0xff, 0xff, 0xf0, LOD1, DRP1,
+  LIT1, 1, ADD1, DUP1, LIT1, 100, CMP1, LIT3, 0, 0, 2, JMP3_SKIP,
+  0,
+};
+
+static uint8_t* ram;
+static uint8_t* rom;
+static volatile uint64_t spin;
+
+// externally defined memory functions
+uint8_t ok_mem_read(size_t address) {
+  if (address == PORT) {
+    for (int i = 0; i < 2000; i++) spin++; // pretend to talk to hardware
+  }
+  return ram[address];
+}
+
+void ok_mem_write(size_t address, uint8_t val) {
+  ram[address] = val;
+}
+
+uint8_t ok_fetch(size_t address) {
+  return rom[address];
+}
+
+int main() {
+  // allocate RAM and ROM
+  ram = calloc(OK_MEM_SIZE, 1);
+  rom = calloc(OK_MEM_SIZE, 1);
+  memcpy(rom, program, sizeof(program));
+
+  ok_acct_init(1); // time every call
+  assert(ok_acct_range("mmio", 0xffff00, OK_MEM_SIZE));
+  assert(ok_acct_range("ram", 0, 0xffff00));
+
+  OkState vm;
+  ok_init(&vm);
+  ok_acct_start();
+  uint64_t ran = ok_run(&vm, UINT64_MAX);
+  ok_acct_stop(ran);
+
+  // test assertions go here
+  assert(vm.status == OK_HALTED);
+  assert(ok_acct.instructions == ran && ok_acct.run_ticks > 0);
+
+  // every instruction and `lit` byte is a fetch
+  assert(ok_acct.fetch.calls == 2 + 100 * 24 + 1);
+  const OkAcctRange* mmio = &ok_acct.ranges[0];
+  const OkAcctRange* ram_range = &ok_acct.ranges[1];
+  assert(ok_acct.nranges == 2 && !strcmp(ok_acct.ranges[2].name, "other"));
+  assert(mmio->read.calls == 100 && mmio->read.sampled == 100);
+  assert(ram_range->read.calls == 100 && ram_range->write.calls == 0);
+  assert(ok_acct.ranges[2].read.calls == 0);
+
+  // the device is where the time went
+  assert(mmio->read.ticks > 10 * ram_range->read.ticks);
+  assert(mmio->read.ticks < ok_acct.run_ticks);
+  uint64_t timed = 0;
+  for (int b = 0; b < OK_ACCT_BUCKETS; b++) timed += mmio->read.hist[b];
+  assert(timed == 100);
+
+  FILE* f = tmpfile();
+  assert(ok_acct_write_report(f));
+  rewind(f);
+  char line[256];
+  int rows = 0;
+  while (fgets(line, sizeof(line), f)) {
+    rows += !strncmp(line, "mmio ", 5) || !strncmp(line, "ram ", 4)
+      || !strncmp(line, "rom ", 4);
+  }
+  fclose(f);
+  assert(rows == 6); // a table row and a histogram each
+
+  // metering looks ahead without the guest fetching anything
+  ok_acct_init(1);
+  OkMeter meter;
+  ok_meter_init(&meter, UINT64_MAX);
+  ok_init(&vm);
+  ok_run_metered(&vm, &meter);
+  assert(vm.status == OK_HALTED && ok_acct.fetch.calls == 2 + 100 * 24 + 1);
+
+  // sampling only times some of the calls, but counts all of them
+  ok_acct_init(7);
+  assert(ok_acct_range("mmio", 0xffff00, OK_MEM_SIZE));
+  ok_init(&vm);
+  ok_run(&vm, UINT64_MAX);
+  assert(ok_acct.ranges[0].read.calls == 100);
+  const OkAcctCounter* counters[] = {
+    &ok_acct.fetch, &ok_acct.ranges[0].read, &ok_acct.ranges[1].read,
+  };
+  for (int i = 0; i < 3; i++) {
+    assert(counters[i]->sampled == (counters[i]->calls + 6) / 7);
+  }
+
+  // calls alternating between two ranges, in step with the sampling, still
+  // get both of them timed
+  ok_acct_init(2);
+  assert(ok_acct_range("mmio", 0xffff00, OK_MEM_SIZE));
+  assert(ok_acct_range("ram", 0, 0xffff00));
+  for (int i = 0; i < 100; i++) {
+    ok_acct_mem_read(0x100);
+    ok_acct_mem_read(PORT);
+  }
+  assert(ok_acct.ranges[0].read.sampled == 50);
+  assert(ok_acct.ranges[1].read.sampled == 50);
+  assert(ok_acct_total(&ok_acct.ranges[0].read) > 0);
+
+  free(ram);
+  free(rom);
+
+  printf("...test-acct PASSED\n");
+  return 0;
+}
@@ -0,0 +1,133 @@
+#define OK_IMPLEMENTATION
+#include "../ok_chan.h"
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// instruction defines go here
+#define LIT1 (0b10001101)
+#define LIT3 (0b10101101)
+#define STR1 (0b10000110)
+#define STR3 (0b10100110)
+
+#define BASE (0x800000) // where the producer's end is mapped
+#define COUNT (200000) // bytes streamed between threads
+
+// program mem goes here: send "hi" down the channel
+static uint8_t program[] = {
+  LIT1, 'h', LIT3, 0x80, 0, OK_CHAN_DATA, STR1,
+  LIT1, 'i', LIT3, 0x80, 0, OK_CHAN_DATA + 1, STR1,
+  LIT3, 0, 0, 2, LIT3, 0x80, 0, OK_CHAN_COMMIT, STR3,
+  0
+};
+
+static uint8_t* ram;
+static OkChan chan;
+static OkChanEnd tx, rx;
+
+// externally defined memory functions
+uint8_t ok_mem_read(size_t address) {
+  if (address - tx.base < ok_chan_window(&chan)) {
+    return ok_chan_read(&tx, address - tx.base);
+  }
+  return ram[address];
+}
+
+void ok_mem_write(size_t address, uint8_t val) {
+  if (address - tx.base < ok_chan_window(&chan)) {
+    ok_chan_write(&tx, address - tx.base, val);
+    return;
+  }
+  ram[address] = val;
+}
+
+uint8_t ok_fetch(size_t address) {
+  return address < sizeof(program) ? program[address] : 0;
+}
+
+// word registers, accessed the way `lod` and `str` would
+static size_t get_word(OkChanEnd* e, size_t offset) {
+  size_t out = 0;
+  for (int i = 0; i < OK_WORD_SIZE; i++) {
+    out = (out << 8) | ok_chan_read(e, offset + i);
+  }
+  return out;
+}
+
+static void set_word(OkChanEnd* e, size_t offset, size_t val) {
+  for (int i = OK_WORD_SIZE - 1; i >= 0; i--) {
+    ok_chan_write(e, offset + i, (uint8_t) val);
+    val >>= 8;
+  }
+}
+
+static void* producer(void* arg) {
+  OkChanEnd* e = arg;
+  for (size_t sent = 0; sent < COUNT;) {
+    set_word(e, OK_CHAN_WAIT, 1);
+    size_t at = get_word(e, OK_CHAN_OFFSET);
+    size_t n = get_word(e, OK_CHAN_AVAIL);
+    if (n > COUNT - sent) n = COUNT - sent;
+    if (n > 100) n = 100;
+    for (size_t i = 0; i < n; i++) {
+      ok_chan_write(e, OK_CHAN_DATA + at + i, (uint8_t) (sent + i));
+    }
+    set_word(e, OK_CHAN_COMMIT, n);
+    sent += n;
+  }
+  ok_chan_write(e, OK_CHAN_STATUS, 1);
+  return NULL;
+}
+
+int main() {
+  ram = calloc(OK_MEM_SIZE, 1);
+
+  // a guest sends through its end of the channel
+  assert(ok_chan_init(&chan, 64));
+  ok_chan_end(&tx, &chan, 1, BASE);
+  ok_chan_end(&rx, &chan, 0, 0);
+  OkState vm;
+  ok_init(&vm);
+  while (vm.status == OK_RUNNING) ok_tick(&vm);
+  assert(get_word(&tx, OK_CHAN_AVAIL) == 62);
+  assert(get_word(&rx, OK_CHAN_AVAIL) == 2);
+  assert(ok_chan_read(&rx, OK_CHAN_DATA) == 'h');
+  assert(ok_chan_read(&rx, OK_CHAN_DATA + 1) == 'i');
+
+  // the data window is mapped twice, so runs don't have to wrap
+  set_word(&rx, OK_CHAN_COMMIT, 2);
+  assert(get_word(&rx, OK_CHAN_AVAIL) == 0);
+  assert(ok_chan_read(&tx, OK_CHAN_DATA + 64) == 'h');
+  set_word(&rx, OK_CHAN_COMMIT, 5); // can't consume more than is there
+  assert(get_word(&tx, OK_CHAN_AVAIL) == 64);
+  ok_chan_destroy(&chan);
+
+  // two threads stream through a small ring, sleeping when they have to
+  assert(ok_chan_init(&chan, 256));
+  ok_chan_end(&tx, &chan, 1, BASE);
+  ok_chan_end(&rx, &chan, 0, 0);
+  pthread_t thread;
+  assert(pthread_create(&thread, NULL, producer, &tx) == 0);
+
+  size_t got = 0;
+  int bad = 0;
+  for (;;) {
+    set_word(&rx, OK_CHAN_WAIT, 1);
+    size_t at = get_word(&rx, OK_CHAN_OFFSET);
+    size_t n = get_word(&rx, OK_CHAN_AVAIL);
+    if (n == 0 && ok_chan_read(&rx, OK_CHAN_STATUS)) break;
+    for (size_t i = 0; i < n; i++) {
+      bad |= ok_chan_read(&rx, OK_CHAN_DATA + at + i) != (uint8_t) (got + i);
+    }
+    set_word(&rx, OK_CHAN_COMMIT, n);
+    got += n;
+  }
+  pthread_join(thread, NULL);
+  assert(got == COUNT && !bad);
+  ok_chan_destroy(&chan);
+
+  printf("...test-chan PASSED\n");
+  free(ram);
+  return 0;
+}
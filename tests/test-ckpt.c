@@ -0,0 +1,133 @@
+#define OK_IMPLEMENTATION
+#include "../ok_ckpt.h"
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// instruction defines go here
+#define LIT3 (0b10101101)
+#define STR2 (0b10010110)
+#define LIT2 (0b10011101)
+
+#define LOG "test-ckpt.log"
+
+// program mem goes here
+static uint8_t program[] = {
+  LIT2,
+  0xab,
+  0xcd,
+  LIT3,
+  0,
+  0,
+  69,
+  STR2, // store 0xabcd at RAM[69]
+  LIT2,
+  0x12,
+  0x34,
+  LIT3,
+  0x10,
+  0,
+  0,
+  STR2, // store 0x1234 at RAM[0x100000]
+  0
+};
+
+static uint8_t* ram;
+static OkCheckpoint ckpt;
+
+// externally defined memory functions
+uint8_t ok_mem_read(size_t address) {
+  return ram[address];
+}
+
+void ok_mem_write(size_t address, uint8_t val) {
+  ok_ckpt_write(&ckpt, address, val);
+}
+
+uint8_t ok_fetch(size_t address) {
+  return program[address];
+}
+
+static long log_size() {
+  FILE* f = fopen(LOG, "rb");
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fclose(f);
+  return size;
+}
+
+int main() {
+  // allocate RAM
+  ram = calloc(OK_MEM_SIZE, 1);
+  uint8_t* restored = calloc(OK_MEM_SIZE, 1);
+  remove(LOG);
+
+  // a full checkpoint of a nonzero page
+  ram[OK_MEM_SIZE - 1] = 0x77;
+  assert(ok_ckpt_open(&ckpt, ram, LOG));
+  OkState vm;
+  ok_init(&vm);
+  assert(ok_ckpt_save(&ckpt, &vm));
+  long base = log_size();
+
+  // run part of the program, then checkpoint the one page it wrote
+  for (int i = 0; i < 3; i++) ok_tick(&vm);
+  assert(ok_ckpt_save(&ckpt, &vm));
+  long delta = log_size() - base;
+  assert(delta < 2 * OK_CKPT_PAGE);
+
+  // finish up, checkpoint again, and leave a torn record behind
+  while (vm.status == OK_RUNNING) ok_tick(&vm);
+  assert(ok_ckpt_save(&ckpt, &vm));
+  ram[0x200000] = 0x99;
+  fwrite("OKCK", 1, 4, ckpt.log);
+  ok_ckpt_close(&ckpt);
+
+  OkState back;
+  assert(ok_ckpt_restore(LOG, restored, &back) == 3);
+
+  // test assertions go here
+  assert(memcmp(ram, restored, 0x200000) == 0);
+  assert(restored[0x200000] == 0); // never checkpointed
+  assert(restored[69] == 0xab && restored[0x100001] == 0x34);
+  assert(restored[OK_MEM_SIZE - 1] == 0x77);
+  assert(back.pc == vm.pc && back.status == OK_HALTED && back.d == vm.d);
+
+  // reopening cuts the torn record off, so new records stay reachable
+  assert(ok_ckpt_open(&ckpt, restored, LOG));
+  ok_ckpt_clean(&ckpt);
+  ok_ckpt_write(&ckpt, 0x200000, 0x99);
+  assert(ok_ckpt_save(&ckpt, &vm));
+  ok_ckpt_close(&ckpt);
+  assert(ok_ckpt_restore(LOG, restored, &back) == 4);
+  assert(restored[0x200000] == 0x99);
+
+  // so does a whole record whose checksum doesn't match
+  long size = log_size();
+  FILE* f = fopen(LOG, "r+b");
+  assert(f && fseek(f, size - 10, SEEK_SET) == 0);
+  assert(fputc(0x42, f) == 0x42 && fclose(f) == 0);
+  assert(ok_ckpt_restore(LOG, restored, &back) == 3);
+  assert(ok_ckpt_open(&ckpt, restored, LOG));
+  assert(log_size() < size);
+  ok_ckpt_clean(&ckpt);
+  ok_ckpt_write(&ckpt, 0x200000, 0x55);
+  assert(ok_ckpt_save(&ckpt, &vm));
+  ok_ckpt_close(&ckpt);
+  assert(ok_ckpt_restore(LOG, restored, &back) == 4);
+  assert(restored[0x200000] == 0x55);
+
+  // a file that isn't a log is refused, not cut down to nothing
+  f = fopen(LOG, "wb");
+  assert(f && fputs("not a checkpoint log\n", f) >= 0 && fclose(f) == 0);
+  size = log_size();
+  assert(!ok_ckpt_open(&ckpt, restored, LOG));
+  assert(log_size() == size);
+
+  printf("...test-ckpt PASSED\n");
+  remove(LOG);
+  free(ram);
+  free(restored);
+  return 0;
+}
@@ -0,0 +1,116 @@
+#define OK_IMPLEMENTATION
+#include "../ok_code.h"
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// instruction defines go here
+#define LIT1 (0b10001101)
+#define LIT3 (0b10101101)
+#define ADD1 (0b10000000)
+#define DUP1 (0b10001000)
+#define JMP3_SKIP (0b11101100)
+
+#define THREADS (8)
+
+// program mem goes here: counts down from 200 without touching RAM, so
+// every thread can run it at once
+static uint8_t program[] = {
+  LIT1, 200, // 0
+  LIT1, 0xff, ADD1, // 2: count down
+  DUP1, LIT3, 0, 0, 2, JMP3_SKIP, // 5: loop while nonzero
+  LIT1, 7, // 11
+  0 // 13
+};
+
+static uint8_t* rom;
+static OkCodeCache cache;
+static OkCode* got[THREADS];
+
+// externally defined memory functions
+uint8_t ok_mem_read(size_t address) {
+  (void) address;
+  return 0;
+}
+
+void ok_mem_write(size_t address, uint8_t val) {
+  (void) address;
+  (void) val;
+}
+
+uint8_t ok_fetch(size_t address) {
+  return rom[address % OK_MEM_SIZE];
+}
+
+static void check_run(const OkCode* code, uint8_t top) {
+  OkState vm;
+  ok_init(&vm);
+  ok_code_run(code, &vm, UINT64_MAX);
+  // the counter, the jump address left behind by the skipped jmp, and top
+  assert(vm.status == OK_HALTED && vm.d == 5);
+  assert(vm.dst[0] == 0 && vm.dst[3] == 2 && vm.dst[4] == top);
+}
+
+static void* worker(void* arg) {
+  int id = (int) (size_t) arg;
+  for (int i = 0; i < 20; i++) {
+    OkCode* code = ok_code_cache_get(&cache, rom, sizeof(program));
+    assert(code);
+    check_run(code, 7);
+    if (i == 0) got[id] = ok_code_retain(code);
+    ok_code_free(code);
+  }
+  return NULL;
+}
+
+int main() {
+  rom = calloc(OK_MEM_SIZE, 1);
+  memcpy(rom, program, sizeof(program));
+  ok_code_cache_init(&cache, NULL);
+
+  // every thread ends up with the same code
+  pthread_t threads[THREADS];
+  for (int i = 0; i < THREADS; i++) {
+    assert(pthread_create(&threads[i], NULL, worker, (void*) (size_t) i) == 0);
+  }
+  for (int i = 0; i < THREADS; i++) pthread_join(threads[i], NULL);
+  for (int i = 1; i < THREADS; i++) assert(got[i] == got[0]);
+  assert(got[0]->refs == THREADS + 1); // plus the cache's own
+
+  // writing to shared code copies it, leaving everyone else's alone
+  OkCode* mine = ok_code_write(got[0], 12, 9);
+  assert(mine && mine != got[1]);
+  check_run(mine, 9);
+  check_run(got[1], 7);
+  assert(got[1]->refs == THREADS);
+
+  // code nobody shares is patched in place
+  OkCode* same = ok_code_write(mine, 12, 5);
+  assert(same == mine);
+  check_run(same, 5);
+
+  // and can grow past its end
+  same = ok_code_write(same, 13, 0x8f);
+  assert(same && same->len == 14);
+  OkState vm;
+  ok_init(&vm);
+  ok_code_run(same, &vm, UINT64_MAX);
+  assert(vm.status == OK_HALTED && vm.pc == 15); // ran the nop at 13
+  ok_code_free(same);
+
+  // a different ROM gets different code
+  rom[1] = 100;
+  OkCode* other = ok_code_cache_get(&cache, rom, sizeof(program));
+  assert(other && other != got[1]);
+  check_run(other, 7);
+  ok_code_free(other);
+
+  for (int i = 1; i < THREADS; i++) ok_code_free(got[i]);
+  ok_code_cache_destroy(&cache);
+  free(rom);
+
+  printf("...test-code-cache PASSED\n");
+  return 0;
+}
@@ -0,0 +1,140 @@
+#define OK_IMPLEMENTATION
+#include "../ok_code.h"
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// instruction defines go here
+#define LIT1 (0b10001101)
+#define LIT3 (0b10101101)
+#define ADD1 (0b10000000)
+#define DUP1 (0b10001000)
+#define STR1 (0b10000110)
+#define JMP3_SKIP (0b11101100)
+
+// program mem goes here
+static uint8_t program[] = {
+  LIT1, 10, // 0
+  LIT1, 0xff, ADD1, // 2: count down
+  DUP1, LIT3, 0, 0, 69, STR1, // 5: RAM[69] = counter
+  DUP1, LIT3, 0, 0, 2, JMP3_SKIP, // 11: loop while nonzero
+  0 // 17
+};
+
+static uint8_t* ram;
+static uint8_t* rom;
+static uint64_t writes; // hash of every write, to compare runs cheaply
+
+// externally defined memory functions
+uint8_t ok_mem_read(size_t address) {
+  return ram[address % OK_MEM_SIZE];
+}
+
+void ok_mem_write(size_t address, uint8_t val) {
+  writes = (writes ^ (address * 31 + val)) * 1099511628211ull;
+  ram[address % OK_MEM_SIZE] = val;
+}
+
+uint8_t ok_fetch(size_t address) {
+  return rom[address % OK_MEM_SIZE];
+}
+
+// run the ROM for at most max instructions, either ticking or from code
+static uint64_t run(const OkCode* code, OkState* vm, uint64_t max) {
+  writes = 0;
+  ok_init(vm);
+  if (code) return ok_code_run(code, vm, max);
+
+  uint64_t n = 0;
+  for (; vm->status == OK_RUNNING && n < max; n++) ok_tick(vm);
+  return n;
+}
+
+static void same(const OkCode* code, uint64_t max) {
+  OkState a, b;
+  uint64_t na = run(NULL, &a, max);
+  uint64_t wa = writes;
+  uint64_t nb = run(code, &b, max);
+  assert(na == nb && wa == writes);
+  assert(a.pc == b.pc && a.status == b.status && a.d == b.d && a.r == b.r);
+  assert(memcmp(a.dst, b.dst, 256) == 0 && memcmp(a.rst, b.rst, 256) == 0);
+}
+
+int main() {
+  // allocate RAM and ROM
+  ram = calloc(OK_MEM_SIZE, 1);
+  rom = calloc(OK_MEM_SIZE, 1);
+  memcpy(rom, program, sizeof(program));
+
+  OkCode* code = ok_code_build(rom, OK_MEM_SIZE);
+  assert(code && code->len == sizeof(program) - 1); // trailing halt trimmed
+  assert(code->insns[2].flags & OK_CODE_LEADER); // loop head
+  assert(code->insns[2].run == 8); // instructions up to the jmp
+  same(code, UINT64_MAX);
+  assert(ram[69] == 0);
+  for (uint64_t max = 0; max < 40; max++) same(code, max); // cut mid-block
+  ok_code_free(code);
+
+  // random bytes exercise every opcode, flag, and width
+  srand(1);
+  for (int i = 0; i < 300; i++) {
+    for (int k = 0; k < 64; k++) rom[k] = (uint8_t) rand();
+    code = ok_code_build(rom, 64);
+    same(code, 2000);
+    ok_code_free(code);
+  }
+
+  // the second load maps what the first one saved
+  memset(rom, 0, 64);
+  memcpy(rom, program, sizeof(program));
+  char dir[] = "/tmp/test-code-XXXXXX";
+  assert(mkdtemp(dir));
+  OkCode* built = ok_code_load(rom, sizeof(program), dir);
+  OkCode* mapped = ok_code_load(rom, sizeof(program), dir);
+  assert(built && !built->map && mapped && mapped->map);
+  assert(memcmp(built->insns, mapped->insns, sizeof(OkInsn) * built->len) == 0);
+  same(mapped, UINT64_MAX);
+
+  // a different ROM misses, and a damaged file falls back to decoding
+  char path[4096];
+  ok_code_path(path, sizeof(path), dir, mapped->hash);
+  ok_code_free(mapped);
+  assert(truncate(path, 100) == 0);
+  mapped = ok_code_load(rom, sizeof(program), dir);
+  assert(mapped && !mapped->map);
+  ok_code_free(mapped);
+  mapped = ok_code_load(rom, sizeof(program), dir);
+  assert(mapped && mapped->map); // rewritten by the fallback
+  ok_code_free(mapped);
+
+  // so does one whose instruction records were changed, here to a `len` of
+  // 0 at the loop head that would never get past it
+  FILE* f = fopen(path, "r+b");
+  assert(f);
+  fseek(f, ok_code_insns_at(sizeof(program) - 1) + 2 * sizeof(OkInsn) + 1,
+    SEEK_SET);
+  assert(fputc(0, f) == 0 && fclose(f) == 0);
+  mapped = ok_code_load(rom, sizeof(program), dir);
+  assert(mapped && !mapped->map && mapped->insns[2].len == 2);
+  same(mapped, UINT64_MAX);
+  ok_code_free(mapped);
+
+  rom[1] = 20;
+  OkCode* other = ok_code_load(rom, sizeof(program), dir);
+  assert(other && !other->map && other->hash != built->hash);
+  same(other, UINT64_MAX);
+
+  remove(path);
+  ok_code_path(path, sizeof(path), dir, other->hash);
+  remove(path);
+  rmdir(dir);
+  ok_code_free(built);
+  ok_code_free(other);
+
+  printf("...test-code PASSED\n");
+  free(ram);
+  free(rom);
+  return 0;
+}
@@ -0,0 +1,98 @@
+#define OK_IMPLEMENTATION
+#include "../ok_constexpr.hpp"
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+// instruction defines go here
+#define LIT1 (0b10001101)
+#define LIT2 (0b10011101)
+#define LIT3 (0b10101101)
+#define ADD1 (0b10000000)
+#define CMP1 (0b10000101)
+#define STR1 (0b10000110)
+#define DUP1 (0b10001000)
+#define PSH1 (0b10001010)
+#define POP1 (0b10001011)
+#define JMP3_SKIP (0b11101100)
+
+// program mem goes here: RAM[i] = i * (i + 1) / 2 for i below 16, with i
+// kept on the return stack
+constexpr std::array<std::uint8_t, 32> triangles = {
+  LIT1, 0, LIT1, 0, PSH1, // 0: t = 0, i = 0
+  POP1, DUP1, PSH1, ADD1, // 5: t += i
+  DUP1, LIT2, 0, 0, POP1, DUP1, PSH1, STR1, // 9: RAM[i] = t
+  POP1, LIT1, 1, ADD1, DUP1, PSH1, // 17: i++
+  LIT1, 16, CMP1, LIT3, 0, 0, 5, JMP3_SKIP, // 23: loop while i != 16
+  0 // 31
+};
+
+// everything here happens while compiling
+constexpr auto vm = ok::run<16>(triangles);
+static_assert(vm.status == OK_HALTED);
+static_assert(vm.pc == 32 && vm.r == 1 && vm.rst[0] == 16);
+static_assert(vm.ram[1] == 1 && vm.ram[4] == 10 && vm.ram[15] == 120);
+static_assert(vm.d == 4 && vm.top(3) == 5); // the restored jump address
+constexpr auto table = vm.ram;
+static_assert(ok::run<16>(triangles, 10).status == OK_OUT_OF_FUEL);
+static_assert(ok::run<8>(triangles).status == OK_PANIC); // RAM too small
+
+// the C VM, to compare against
+static std::vector<std::uint8_t> ram(OK_MEM_SIZE);
+static std::vector<std::size_t> written;
+static std::array<std::uint8_t, 64> rom;
+
+uint8_t ok_mem_read(size_t address) {
+  return ram[address % OK_MEM_SIZE];
+}
+
+void ok_mem_write(size_t address, uint8_t val) {
+  written.push_back(address % OK_MEM_SIZE);
+  ram[address % OK_MEM_SIZE] = val;
+}
+
+uint8_t ok_fetch(size_t address) {
+  return address < rom.size() ? rom[address] : 0;
+}
+
+int main() {
+  for (int i = 0; i < 16; i++) assert(table[i] == i * (i + 1) / 2);
+
+  // random bytes exercise every opcode, flag, and width the same way
+  auto big = std::make_unique<ok::Vm<OK_MEM_SIZE>>();
+  std::srand(1);
+  for (int round = 0; round < 2000; round++) {
+    for (auto& byte : rom) byte = (std::uint8_t) (std::rand() | 0x80);
+
+    OkState c;
+    ok_init(&c);
+    ok::Vm<OK_MEM_SIZE>& v = *big;
+    v.d = v.r = 0;
+    v.dst = {};
+    v.rst = {};
+    v.pc = 0;
+    v.status = OK_RUNNING;
+    v.steps = 0;
+
+    for (int step = 0; step < 200 && c.status == OK_RUNNING; step++) {
+      ok_tick(&c);
+      v.tick(rom);
+      if (v.status == OK_PANIC) break; // went past the end of RAM
+      assert(c.status == v.status && c.pc == v.pc);
+      assert(c.d == v.d && c.r == v.r);
+      for (int i = 0; i < 256; i++) {
+        assert(c.dst[i] == v.dst[i] && c.rst[i] == v.rst[i]);
+      }
+    }
+    for (std::size_t address : written) {
+      assert(v.status == OK_PANIC || ram[address] == v.ram[address]);
+      ram[address] = v.ram[address] = 0;
+    }
+    written.clear();
+  }
+
+  std::printf("...test-constexpr PASSED\n");
+  return 0;
+}
@@ -0,0 +1,99 @@
+#define OK_IMPLEMENTATION
+#include "../ok.h"
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+
+// instruction defines go here
+#define LIT1 (0b10001101)
+#define LIT3 (0b10101101)
+#define STR1 (0b10000110)
+#define STR3 (0b10100110)
+#define LOD3 (0b10100111)
+
+// register addresses
+#define A_LOW3 0xff, 0xff, 0x01
+#define B_LOW3 0xff, 0xff, 0x05
+#define OP 0xff, 0xff, 0x08
+#define LO_LOW3 0xff, 0xff, 0x0b
+#define HI_LOW3 0xff, 0xff, 0x0f
+
+// program mem goes here
+static uint8_t program[] = {
+  LIT3, 0x00, 0x04, 0xd2, LIT3, A_LOW3, STR3, // A = 1234
+  LIT3, 0x00, 0x02, 0x37, LIT3, B_LOW3, STR3, // B = 567
+  LIT1, 0x20 | OK_COPROC_MUL, LIT3, OP, STR1, // 24-bit multiply
+  LIT3, LO_LOW3, LOD3, LIT3, 0, 0, 69, STR3, // RAM[69] = 1234 * 567
+  LIT1, 0x20 | OK_COPROC_DIV, LIT3, OP, STR1, // 24-bit divide
+  LIT3, LO_LOW3, LOD3, LIT3, 0, 0, 72, STR3, // RAM[72] = 1234 / 567
+  LIT3, HI_LOW3, LOD3, LIT3, 0, 0, 75, STR3, // RAM[75] = 1234 % 567
+  0
+};
+
+static uint8_t* ram;
+static OkCoproc coproc;
+
+// externally defined memory functions
+uint8_t ok_mem_read(size_t address) {
+  if (address >= OK_COPROC_BASE && address < OK_COPROC_BASE + OK_COPROC_SIZE) {
+    return ok_coproc_read(&coproc, address - OK_COPROC_BASE);
+  }
+  return ram[address];
+}
+
+void ok_mem_write(size_t address, uint8_t val) {
+  if (address >= OK_COPROC_BASE && address < OK_COPROC_BASE + OK_COPROC_SIZE) {
+    ok_coproc_write(&coproc, address - OK_COPROC_BASE, val);
+    return;
+  }
+  ram[address] = val;
+}
+
+uint8_t ok_fetch(size_t address) {
+  return program[address];
+}
+
+// run one operation straight through the register interface
+static void op(uint8_t width, uint8_t which, uint32_t a, uint32_t b) {
+  ok_set_bytes(coproc.regs, OK_COPROC_A, 4, a);
+  ok_set_bytes(coproc.regs, OK_COPROC_B, 4, b);
+  ok_coproc_write(&coproc, OK_COPROC_OP, ((width - 1) << 4) | which);
+}
+
+static uint32_t lo() { return ok_get_bytes(coproc.regs, OK_COPROC_LO, 4); }
+static uint32_t hi() { return ok_get_bytes(coproc.regs, OK_COPROC_HI, 4); }
+
+int main() {
+  // allocate RAM
+  ram = calloc(OK_MEM_SIZE, 1);
+
+  OkState vm;
+  ok_init(&vm);
+  while (vm.status == OK_RUNNING) ok_tick(&vm);
+
+  // test assertions go here
+  assert(vm.status == OK_HALTED);
+  assert(ok_get_bytes(ram, 69, 3) == 1234 * 567);
+  assert(ok_get_bytes(ram, 72, 3) == 1234 / 567);
+  assert(ok_get_bytes(ram, 75, 3) == 1234 % 567);
+
+  op(1, OK_COPROC_MUL, 200, 3); // widening: 600 = 0x0258
+  assert(lo() == 0x58 && hi() == 0x02);
+  op(1, OK_COPROC_MULS, 0xff, 3); // -1 * 3 = -3, sign-extended into HI
+  assert(lo() == 0xfd && hi() == 0xff);
+  op(4, OK_COPROC_MUL, 0xffffffff, 0xffffffff);
+  assert(lo() == 1 && hi() == 0xfffffffe);
+  op(1, OK_COPROC_DIVS, 0xf9, 2); // -7 / 2 = -3 remainder -1
+  assert(lo() == 0xfd && hi() == 0xff);
+  op(2, OK_COPROC_DIVS, 0x8000, 0xffff); // overflow wraps
+  assert(lo() == 0x8000 && hi() == 0);
+  op(3, OK_COPROC_DIV, 5, 0);
+  assert(coproc.regs[OK_COPROC_STATUS] == 1);
+  assert(lo() == 0xffffff && hi() == 5);
+  op(3, OK_COPROC_DIV, 5, 1);
+  assert(coproc.regs[OK_COPROC_STATUS] == 0);
+
+  printf("...test-coproc PASSED\n");
+  free(ram);
+  return 0;
+}
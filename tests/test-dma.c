@@ -0,0 +1,110 @@
+#define OK_IMPLEMENTATION
+#include "../ok.h"
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// instruction defines go here
+#define LIT1 (0b10001101)
+#define LIT3 (0b10101101)
+#define STR1 (0b10000110)
+#define STR3 (0b10100110)
+
+// register addresses
+#define SRC 0xff, 0xff, 0x20
+#define DST 0xff, 0xff, 0x23
+#define LEN 0xff, 0xff, 0x26
+#define OP 0xff, 0xff, 0x2a
+
+// program mem goes here
+static uint8_t program[] = {
+  // copy the 12-byte string at ROM[0x40] into RAM[0x1000]
+  LIT3, 0x00, 0x00, 0x40, LIT3, SRC, STR3,
+  LIT3, 0x00, 0x10, 0x00, LIT3, DST, STR3,
+  LIT3, 0x00, 0x00, 0x0c, LIT3, LEN, STR3,
+  LIT1, OK_DMA_LOAD, LIT3, OP, STR1,
+  0,
+  [0x40] = 'h', 'e', 'l', 'l', 'o', ',', ' ', 'w', 'o', 'r', 'l', 'd',
+};
+
+static uint8_t* ram;
+static uint8_t* rom;
+static OkDma dma;
+
+// externally defined memory functions
+uint8_t ok_mem_read(size_t address) {
+  if (address >= OK_DMA_BASE && address < OK_DMA_BASE + OK_DMA_SIZE) {
+    return ok_dma_read(&dma, address - OK_DMA_BASE);
+  }
+  return ram[address];
+}
+
+void ok_mem_write(size_t address, uint8_t val) {
+  if (address >= OK_DMA_BASE && address < OK_DMA_BASE + OK_DMA_SIZE) {
+    ok_dma_write(&dma, address - OK_DMA_BASE, val);
+    return;
+  }
+  ram[address] = val;
+}
+
+uint8_t ok_fetch(size_t address) {
+  return rom[address];
+}
+
+// program the engine straight through its registers
+static void dma_op(uint8_t op, size_t src, size_t dst, size_t len, uint8_t val) {
+  ok_set_bytes(dma.regs, OK_DMA_SRC, OK_WORD_SIZE, src);
+  ok_set_bytes(dma.regs, OK_DMA_DST, OK_WORD_SIZE, dst);
+  ok_set_bytes(dma.regs, OK_DMA_LEN, OK_WORD_SIZE, len);
+  dma.regs[OK_DMA_VAL] = val;
+  ok_dma_write(&dma, OK_DMA_OP, op);
+}
+
+static uint32_t result() {
+  return ok_get_bytes(dma.regs, OK_DMA_RESULT, OK_WORD_SIZE);
+}
+
+int main() {
+  // allocate RAM and ROM
+  ram = calloc(OK_MEM_SIZE, 1);
+  rom = calloc(OK_MEM_SIZE, 1);
+  memcpy(rom, program, sizeof(program));
+  dma.ram = ram;
+  dma.rom = rom;
+
+  OkState vm;
+  ok_init(&vm);
+  while (vm.status == OK_RUNNING) ok_tick(&vm);
+
+  // test assertions go here
+  assert(memcmp(&ram[0x1000], "hello, world", 12) == 0);
+  assert(dma.regs[OK_DMA_STATUS] == 0);
+
+  dma_op(OK_DMA_FIND, 0x1000, 0, 12, 'w');
+  assert(result() == 7);
+  dma_op(OK_DMA_FIND, 0x1000, 0, 12, 'z');
+  assert(result() == 0xffffff);
+
+  dma_op(OK_DMA_COPY, 0x1000, 0x1002, 12, 0); // overlapping
+  assert(memcmp(&ram[0x1002], "hello, world", 12) == 0);
+
+  dma_op(OK_DMA_FILL, 0, 0x2000, 1000, 0xaa);
+  assert(ram[0x2000] == 0xaa && ram[0x2000 + 999] == 0xaa);
+  assert(ram[0x2000 + 1000] == 0);
+
+  dma_op(OK_DMA_CMP, 0x1002, 0x2000, 4, 0); // 'h' < 0xaa
+  assert(result() == 255);
+  dma_op(OK_DMA_CMP, 0x2000, 0x2001, 100, 0);
+  assert(result() == 0);
+
+  dma_op(OK_DMA_FILL, 0, OK_MEM_SIZE - 4, 5, 0); // out of bounds
+  assert(dma.regs[OK_DMA_STATUS] == 1);
+  dma_op(0, 0, 0, 0, 0); // unknown
+  assert(dma.regs[OK_DMA_STATUS] == 1);
+
+  printf("...test-dma PASSED\n");
+  free(ram);
+  free(rom);
+  return 0;
+}
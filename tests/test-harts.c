@@ -0,0 +1,163 @@
+#define OK_IMPLEMENTATION
+#include "../ok_hart.h"
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <sched.h>
+
+// instruction defines go here
+#define LIT1 (0b10001101)
+#define LIT3 (0b10101101)
+#define ADD1 (0b10000000)
+#define LOD1 (0b10000111)
+#define DUP1 (0b10001000)
+#define STR1 (0b10000110)
+#define STR3 (0b10100110)
+#define JMP3_SKIP (0b11101100)
+
+// register addresses
+#define ADDR 0xff, 0xff, 0x80
+#define ARG_LOW1 0xff, 0xff, 0x86
+#define ARG_LOW3 0xff, 0xff, 0x84
+#define VALUE_LOW3 0xff, 0xff, 0x88
+#define CTRL 0xff, 0xff, 0x8b
+#define FLAG 0xff, 0xff, 0x8c
+
+#define WORKER (107)
+#define LOOP (109)
+
+// program mem goes here
+static uint8_t program[] = {
+  // main: spawn three workers...
+  LIT3, 0, 0, WORKER, LIT3, ADDR, STR3, // 0
+  LIT1, OK_HART_SPAWN, LIT3, CTRL, STR1, // 9
+  LIT1, OK_HART_SPAWN, LIT3, CTRL, STR1, // 16
+  LIT1, OK_HART_SPAWN, LIT3, CTRL, STR1, // 23
+  // ...wait for all of them...
+  LIT1, 1, LIT3, ARG_LOW1, STR1, // 30
+  LIT1, OK_HART_JOIN, LIT3, CTRL, STR1, // 37
+  LIT1, 2, LIT3, ARG_LOW1, STR1, // 44
+  LIT1, OK_HART_JOIN, LIT3, CTRL, STR1, // 51
+  LIT1, 3, LIT3, ARG_LOW1, STR1, // 58
+  LIT1, OK_HART_JOIN, LIT3, CTRL, STR1, // 65
+  // ...then swap the counter from 300 to 7
+  LIT3, 0, 1, 0, LIT3, ADDR, STR3, // 72
+  LIT3, 0, 1, 44, LIT3, ARG_LOW3, STR3, // 81
+  LIT3, 0, 0, 7, LIT3, VALUE_LOW3, STR3, // 90
+  LIT1, 0x20 | OK_HART_CAS, LIT3, CTRL, STR1, // 99
+  0, // 106
+
+  // worker: atomically add 1 to the counter at RAM[0x100] 100 times
+  LIT1, 100, // 107
+  LIT3, 0, 1, 0, LIT3, ADDR, STR3, // 109
+  LIT1, 1, LIT3, ARG_LOW1, STR1, // 118
+  LIT1, 0x20 | OK_HART_FETCH_ADD, LIT3, CTRL, STR1, // 125
+  LIT1, 0xff, ADD1, // 132: decrement the loop counter
+  DUP1, // 135
+  LIT3, 0, 0, LOOP, JMP3_SKIP, // 136: loop while nonzero
+  0, // 141
+};
+
+#define OTHER (44)
+
+// main and another hart joining each other, so one join has to fail. Each
+// stores 1 + its FLAG once its join is over
+static uint8_t cycle[] = {
+  LIT3, 0, 0, OTHER, LIT3, ADDR, STR3, // 0
+  LIT1, OK_HART_SPAWN, LIT3, CTRL, STR1, // 9
+  LIT1, 1, LIT3, ARG_LOW1, STR1, // 16
+  LIT1, OK_HART_JOIN, LIT3, CTRL, STR1, // 23
+  LIT3, FLAG, LOD1, LIT1, 1, ADD1, LIT3, 0, 2, 0, STR1, // 30
+  0, // 43
+
+  // other: join main
+  LIT1, 0, LIT3, ARG_LOW1, STR1, // 44
+  LIT1, OK_HART_JOIN, LIT3, CTRL, STR1, // 51
+  LIT3, FLAG, LOD1, LIT1, 1, ADD1, LIT3, 0, 2, 1, STR1, // 58
+  0, // 71
+};
+
+static uint8_t* ram;
+static uint8_t* rom = program;
+static size_t rom_len = sizeof(program);
+static OkHarts harts;
+
+// externally defined memory functions
+uint8_t ok_mem_read(size_t address) {
+  if (address >= OK_HART_BASE && address < OK_HART_BASE + OK_HART_SIZE) {
+    return ok_harts_read(&harts, address - OK_HART_BASE);
+  }
+  return ok_harts_load(&harts, address);
+}
+
+void ok_mem_write(size_t address, uint8_t val) {
+  if (address >= OK_HART_BASE && address < OK_HART_BASE + OK_HART_SIZE) {
+    ok_harts_write(&harts, address - OK_HART_BASE, val);
+    return;
+  }
+  ok_harts_store(&harts, address, val);
+}
+
+uint8_t ok_fetch(size_t address) {
+  return address < rom_len ? rom[address] : 0;
+}
+
+// keep storing to the bytes next to the counter at 0x100, finishing with
+// 0x11 to 0x17, while the test adds to it
+static void* neighbour(void* arg) {
+  (void) arg;
+  for (int i = 0; i < 100000; i++) {
+    for (size_t a = 0x101; a < 0x108; a++) {
+      ok_harts_store(&harts, a, (uint8_t) (i + a));
+    }
+  }
+  for (size_t a = 0x101; a < 0x108; a++) ok_harts_store(&harts, a, a - 0xf0);
+  return NULL;
+}
+
+int main() {
+  // allocate RAM
+  ram = calloc(OK_MEM_SIZE, 1);
+  assert(sizeof(program) == 142);
+
+  assert(ok_harts_init(&harts, ram));
+  int main_hart = ok_harts_spawn(&harts, 0);
+  assert(main_hart == 0);
+  OkStatus status = ok_harts_join(&harts, main_hart);
+
+  // test assertions go here
+  assert(status == OK_HALTED);
+  assert(ok_get_bytes(ram, 0x100, 3) == 7); // saw all 300 increments
+  assert(ok_harts_join(&harts, 1) == OK_PANIC); // already joined
+
+  // atomics never lose plain stores to the rest of their word, nor the
+  // other way around
+  pthread_t other;
+  ram[0x100] = 0;
+  assert(pthread_create(&other, NULL, neighbour, NULL) == 0);
+  for (int i = 0; i < 100000; i++) {
+    uint32_t old;
+    assert(ok_harts_rmw(&harts, 0x100, 1, OK_HART_FETCH_ADD, 1, 0, &old));
+  }
+  pthread_join(other, NULL);
+  assert(ram[0x100] == (uint8_t) 100000);
+  for (size_t a = 0x101; a < 0x108; a++) assert(ram[a] == a - 0xf0);
+
+  // harts joining each other: one join fails, and the other returns once
+  // that hart halts
+  rom = cycle;
+  rom_len = sizeof(cycle);
+  assert(sizeof(cycle) == 72);
+  assert(ok_harts_spawn(&harts, 0) == 0);
+  while (!ok_harts_load(&harts, 0x200) || !ok_harts_load(&harts, 0x201)) {
+    sched_yield();
+  }
+  assert(ram[0x200] + ram[0x201] == 3);
+  ok_harts_join(&harts, 0);
+  ok_harts_join(&harts, 1);
+
+  ok_harts_destroy(&harts);
+  printf("...test-harts PASSED\n");
+  free(ram);
+  return 0;
+}
@@ -0,0 +1,160 @@
+#define OK_IMPLEMENTATION
+#include "../ok_heap.h"
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// instruction defines go here
+#define LIT1 (0b10001101)
+#define LIT3 (0b10101101)
+#define STR1 (0b10000110)
+#define STR3 (0b10100110)
+#define LOD3 (0b10100111)
+
+// register addresses
+#define SIZE 0xff, 0xff, 0x40
+#define PTR 0xff, 0xff, 0x43
+#define OP 0xff, 0xff, 0x46
+#define RESULT 0xff, 0xff, 0x48
+
+// program mem goes here
+static uint8_t program[] = {
+  // p = alloc(100); *p = 'x'; free(p)
+  LIT3, 0x00, 0x00, 100, LIT3, SIZE, STR3,
+  LIT1, OK_HEAP_ALLOC, LIT3, OP, STR1,
+  LIT1, 'x', LIT3, RESULT, LOD3, STR1,
+  LIT3, RESULT, LOD3, LIT3, PTR, STR3,
+  LIT1, OK_HEAP_FREE, LIT3, OP, STR1,
+  0,
+};
+
+#define BASE (0x100000)
+#define REGION (0x10000)
+
+static uint8_t* ram;
+static uint8_t* rom;
+static OkHeap heap;
+
+// externally defined memory functions
+uint8_t ok_mem_read(size_t address) {
+  if (address >= OK_HEAP_BASE && address < OK_HEAP_BASE + OK_HEAP_SIZE) {
+    return ok_heap_read(&heap, address - OK_HEAP_BASE);
+  }
+  return ram[address];
+}
+
+void ok_mem_write(size_t address, uint8_t val) {
+  if (address >= OK_HEAP_BASE && address < OK_HEAP_BASE + OK_HEAP_SIZE) {
+    ok_heap_write(&heap, address - OK_HEAP_BASE, val);
+    return;
+  }
+  ram[address] = val;
+}
+
+uint8_t ok_fetch(size_t address) {
+  return rom[address];
+}
+
+#define LIVE (256)
+
+static size_t ptrs[LIVE];
+static size_t lens[LIVE];
+
+// every block is filled with its slot number, so overlaps show up
+static void check(int i) {
+  for (size_t k = 0; k < lens[i]; k++) assert(ram[ptrs[i] + k] == (uint8_t) i);
+}
+
+int main() {
+  // allocate RAM and ROM
+  ram = calloc(OK_MEM_SIZE, 1);
+  rom = calloc(OK_MEM_SIZE, 1);
+  memcpy(rom, program, sizeof(program));
+  assert(!ok_heap_init(&heap, ram, 0, REGION)); // 0 is NULL
+  assert(ok_heap_init(&heap, ram, BASE, REGION));
+
+  OkState vm;
+  ok_init(&vm);
+  while (vm.status == OK_RUNNING) ok_tick(&vm);
+
+  // test assertions go here
+  assert(vm.status == OK_HALTED);
+  assert(ram[BASE] == 'x');
+  assert(heap.regs[OK_HEAP_STATUS] == 0);
+  OkHeapStats st = ok_heap_stats(&heap);
+  assert(st.allocs == 1 && st.frees == 1 && st.failed == 0);
+  assert(st.live == 0 && st.used == 0 && st.free == REGION);
+
+  // freeing it again is caught
+  ok_heap_write(&heap, OK_HEAP_OP, OK_HEAP_FREE);
+  assert(heap.regs[OK_HEAP_STATUS] == 1);
+  assert(!ok_heap_free(&heap, BASE + 8)); // not a block either
+
+  // sizes round up to powers of two, aligned from the base
+  size_t a = ok_heap_alloc(&heap, 20), b = ok_heap_alloc(&heap, 16);
+  assert(a == BASE && b == BASE + 32);
+  st = ok_heap_stats(&heap);
+  assert(st.live == 36 && st.used == 48);
+  assert(st.largest == REGION / 2 && st.fragmentation > 0);
+
+  // growing into free buddies doesn't move, shrinking never does
+  assert(ok_heap_realloc(&heap, b, 32) == b);
+  assert(ok_heap_realloc(&heap, b, 1000) != b); // its buddy is a's
+  assert(ok_heap_realloc(&heap, a, 200) == a); // a's merged with b's old one
+  assert(ok_heap_realloc(&heap, a, 10) == a);
+  assert(ok_heap_stats(&heap).moves == 1);
+  assert(ok_heap_alloc(&heap, REGION) == 0); // too big
+  ok_heap_destroy(&heap);
+
+  // random allocations against a model, in an awkwardly sized region
+  assert(ok_heap_init(&heap, ram, BASE, REGION * 3 - 48));
+  memset(ptrs, 0, sizeof(ptrs));
+  srand(1);
+  for (int round = 0; round < 200000; round++) {
+    int i = rand() % LIVE;
+    size_t len = 1 + rand() % (rand() % 8 == 0 ? 4096 : 64);
+    if (ptrs[i]) check(i);
+
+    if (ptrs[i] && rand() % 2) {
+      size_t moved = ok_heap_realloc(&heap, ptrs[i], len);
+      if (moved == 0) continue; // out of memory, the block stays
+      ptrs[i] = moved;
+      lens[i] = lens[i] < len ? lens[i] : len;
+      check(i);
+    } else if (ptrs[i]) {
+      assert(ok_heap_free(&heap, ptrs[i]));
+      ptrs[i] = 0;
+      continue;
+    } else {
+      ptrs[i] = ok_heap_alloc(&heap, len);
+      if (ptrs[i] == 0) continue;
+    }
+    assert((ptrs[i] - BASE) % OK_HEAP_MIN == 0);
+    assert(ptrs[i] + len <= BASE + REGION * 3 - 48);
+    lens[i] = len;
+    memset(ram + ptrs[i], i, len);
+  }
+
+  uint64_t live = 0;
+  for (int i = 0; i < LIVE; i++) live += ptrs[i] ? lens[i] : 0;
+  st = ok_heap_stats(&heap);
+  assert(st.live == live);
+  assert(st.used + st.free == REGION * 3 - 48);
+
+  // freeing everything gets the region back in as few blocks as it was
+  for (int i = 0; i < LIVE; i++) {
+    if (ptrs[i]) check(i);
+    assert(ok_heap_free(&heap, ptrs[i]));
+  }
+  st = ok_heap_stats(&heap);
+  assert(st.live == 0 && st.used == 0 && st.largest == 2 * REGION);
+  assert(ok_heap_alloc(&heap, 2 * REGION) == BASE);
+  ok_heap_destroy(&heap);
+
+  free(ram);
+  free(rom);
+
+  printf("...test-heap PASSED\n");
+  return 0;
+}
@@ -0,0 +1,108 @@
+#define OK_IMPLEMENTATION
+#include "../ok_heat.h"
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// instruction defines go here
+#define LIT1 (0b10001101)
+#define LIT3 (0b10101101)
+#define STR1 (0b10000110)
+#define JMP3 (0b10101100)
+
+// program mem goes here: store to three pages in turn, forever
+static uint8_t program[] = {
+  LIT1, 1, LIT3, 0, 0, 69, STR1, // 0: page 0
+  LIT1, 2, LIT3, 0x10, 0, 0, STR1, // 7: page 0x100
+  LIT1, 3, LIT3, 0x20, 0, 0, STR1, // 14: page 0x200
+  LIT3, 0, 0, 0, JMP3 // 21
+};
+
+static uint8_t* ram;
+static OkHeat heat;
+
+// externally defined memory functions
+uint8_t ok_mem_read(size_t address) {
+  ok_heat_read(&heat, address);
+  return ram[address];
+}
+
+void ok_mem_write(size_t address, uint8_t val) {
+  ok_heat_write(&heat, address);
+  ram[address] = val;
+}
+
+uint8_t ok_fetch(size_t address) {
+  ok_heat_fetch(&heat, address);
+  return address < sizeof(program) ? program[address] : 0;
+}
+
+int main() {
+  // allocate RAM
+  ram = calloc(OK_MEM_SIZE, 1);
+
+  // 100 trips around the loop, in windows of 10
+  assert(ok_heat_init(&heat, 110));
+  heat.sample = 1;
+  heat.countdown = 1;
+  OkHooks hooks;
+  ok_hooks_init(&hooks);
+  assert(ok_hooks_add(&hooks, ok_heat_hook, &heat));
+  OkState vm;
+  ok_init(&vm);
+  vm.hooks = &hooks;
+  assert(ok_run(&vm, 1100) == 1100);
+  ok_heat_flush(&heat);
+
+  // test assertions go here
+  assert(heat.ram[0].writes == 100 && heat.ram[0].reads == 0);
+  assert(heat.ram[0x100].writes == 100 && heat.ram[0x200].writes == 100);
+  assert(heat.ram[0].first == 3 && heat.ram[0x100].first == 6);
+  assert(heat.ram[1].first == UINT64_MAX);
+  assert(heat.rom[0].fetches == 100 * sizeof(program));
+
+  // the working set is three RAM pages and one ROM page throughout
+  assert(heat.nwindows == 10);
+  for (size_t i = 0; i < heat.nwindows; i++) {
+    assert(heat.windows[i].ram == 3 && heat.windows[i].rom == 1);
+  }
+
+  // every page comes back after the two others
+  for (int b = 0; b < OK_HEAT_BUCKETS; b++) {
+    assert(b == 2 ? heat.reuse[b] > 0 : heat.reuse[b] == 0);
+  }
+
+  // the exports mention each touched page
+  FILE* f = tmpfile();
+  assert(ok_heat_write_pages(&heat, f));
+  rewind(f);
+  char line[256];
+  int rows = 0;
+  while (fgets(line, sizeof(line), f)) rows++;
+  assert(rows == 1 + 4);
+  assert(ok_heat_write_report(&heat, f));
+  fclose(f);
+  ok_heat_free(&heat);
+
+  // pages never touched again give up their watch slots to new samples
+  assert(ok_heat_init(&heat, 0));
+  heat.sample = 1;
+  heat.countdown = 1;
+  for (size_t page = 1; page <= OK_HEAT_WATCH + 4; page++) {
+    ok_heat_write(&heat, page * OK_HEAT_PAGE);
+  }
+  assert(heat.watching == OK_HEAT_WATCH && heat.unreused == 4);
+  ok_heat_write(&heat, 100 * OK_HEAT_PAGE);
+  ok_heat_write(&heat, 100 * OK_HEAT_PAGE);
+  assert(heat.unreused == 5 && heat.reuse[0] == 1);
+  ok_heat_read(&heat, 0);
+  ok_heat_read(&heat, 0);
+  ok_heat_read(&heat, 100 * OK_HEAT_PAGE);
+  assert(heat.reuse[0] == 2 && heat.reuse[1] == 1); // page 0 in between
+
+  printf("...test-heat PASSED\n");
+  ok_heat_free(&heat);
+  free(ram);
+  return 0;
+}
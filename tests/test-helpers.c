@@ -2,9 +2,12 @@
 #include "../ok.h"
 #include <stdio.h>
 #include <assert.h>
+#include <string.h>
 
 void test_byte_set();
 void test_byte_fetch();
+void test_array_fetch();
+void test_array_set();
 
 uint8_t ok_mem_read(size_t address) {
   return 0;
@@ -23,6 +26,8 @@ int main() {
 
   test_byte_fetch();
   test_byte_set();
+  test_array_fetch();
+  test_array_set();
 
   return 0;
 }
@@ -48,5 +53,72 @@ void test_byte_set() {
   assert(buffer[3] == 0x01);
   assert(buffer[4] == 0x45);
 
+  printf("PASSED");
+}
+
+void test_array_fetch() {
+  printf("\n    ok_get_array ");
+  uint8_t buffer[200];
+  uint32_t out[64];
+
+  for (int i = 0; i < 200; i++) buffer[i] = (uint8_t) (i * 37 + 11);
+
+  // every width, count and alignment matches ok_get_bytes
+  for (uint8_t amt = 1; amt <= 4; amt++) {
+    for (size_t index = 0; index < 5; index++) {
+      for (size_t count = 0; count <= 40; count++) {
+        assert(ok_get_array(buffer, 200, index, amt, out, count));
+        for (size_t i = 0; i < count; i++) {
+          assert(out[i] == ok_get_bytes(buffer, index + amt * i, amt));
+        }
+      }
+    }
+  }
+
+  // values running right up to the end of the buffer
+  assert(ok_get_array(buffer, 200, 200 - 3 * 40, 3, out, 40));
+  assert(out[39] == ok_get_bytes(buffer, 197, 3));
+
+  // out of bounds, or a bad width
+  out[0] = 1234;
+  assert(!ok_get_array(buffer, 200, 200 - 3 * 40 + 1, 3, out, 40));
+  assert(!ok_get_array(buffer, 200, 201, 1, out, 0));
+  assert(!ok_get_array(buffer, 200, 0, 5, out, 1));
+  assert(!ok_get_array(buffer, 200, 0, 0, out, 1));
+  assert(!ok_get_array(buffer, 200, 8, 4, out, (size_t) -1 / 2));
+  assert(out[0] == 1234);
+  printf("PASSED");
+}
+
+void test_array_set() {
+  printf("\n    ok_set_array ");
+  uint8_t buffer[200];
+  uint8_t expect[200];
+  uint32_t vals[64];
+
+  for (int i = 0; i < 64; i++) vals[i] = 0x9e3779b9u * (i + 1);
+
+  // every width, count and alignment matches ok_set_bytes, and bytes
+  // around the array are left alone
+  for (uint8_t amt = 1; amt <= 4; amt++) {
+    for (size_t index = 0; index < 5; index++) {
+      for (size_t count = 0; count <= 40; count++) {
+        memset(buffer, 0xaa, 200);
+        memset(expect, 0xaa, 200);
+        assert(ok_set_array(buffer, 200, index, amt, vals, count));
+        for (size_t i = 0; i < count; i++) {
+          ok_set_bytes(expect, index + amt * i, amt, vals[i]);
+        }
+        assert(memcmp(buffer, expect, 200) == 0);
+      }
+    }
+  }
+
+  // out of bounds
+  memset(buffer, 0xaa, 200);
+  assert(!ok_set_array(buffer, 200, 81, 3, vals, 40));
+  assert(!ok_set_array(buffer, 200, 0, 5, vals, 1));
+  assert(buffer[81] == 0xaa && buffer[199] == 0xaa);
+
   printf("PASSED\n");
 }
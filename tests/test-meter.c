@@ -0,0 +1,160 @@
+#define OK_IMPLEMENTATION
+#include "../ok_tier.h"
+#include "../ok_prof.h"
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+
+// instruction defines go here
+#define LIT1 (0b10001101)
+#define LIT3 (0b10101101)
+#define ADD1 (0b10000000)
+#define DUP1 (0b10001000)
+#define STR1 (0b10000110)
+#define JMP3_SKIP (0b11101100)
+
+// program mem goes here
+static uint8_t program[] = {
+  LIT1, 10, // 0
+  LIT1, 0xff, ADD1, // 2: count down
+  DUP1, LIT3, 0, 0, 69, STR1, // 5: RAM[69] = counter
+  DUP1, LIT3, 0, 0, 2, JMP3_SKIP, // 11: loop while nonzero
+  0 // 17
+};
+
+static uint8_t* ram;
+static OkCode* code;
+static OkTier tier;
+
+// engines metered through ok_meter_hook
+static uint64_t run_tick(void* ctx, OkState* vm, uint64_t max) {
+  (void) ctx;
+  return ok_run(vm, max);
+}
+
+static uint64_t run_code(void* ctx, OkState* vm, uint64_t max) {
+  (void) ctx;
+  return ok_code_run(code, vm, max);
+}
+
+static uint64_t run_tier(void* ctx, OkState* vm, uint64_t max) {
+  (void) ctx;
+  return ok_tier_run(&tier, vm, max);
+}
+
+static const OkProfEngine engines[] = {
+  run_tick, run_code, run_tier,
+};
+
+static void meter_init(OkMeter* m, uint64_t fuel) {
+  ok_meter_init(m, fuel);
+  ok_meter_set_cost(m, OK_ADD, 1, 3);
+  ok_meter_set_cost(m, OK_STR, 1, 5);
+}
+
+// externally defined memory functions
+uint8_t ok_mem_read(size_t address) {
+  return ram[address];
+}
+
+void ok_mem_write(size_t address, uint8_t val) {
+  ram[address] = val;
+}
+
+uint8_t ok_fetch(size_t address) {
+  return program[address];
+}
+
+int main() {
+  // allocate RAM
+  ram = calloc(OK_MEM_SIZE, 1);
+
+  OkMeter meter;
+  ok_meter_init(&meter, 0);
+  ok_meter_set_cost(&meter, OK_ADD, 1, 3);
+  ok_meter_set_cost(&meter, OK_STR, 1, 5);
+
+  // charging one instruction at a time is the reference for every budget
+  uint64_t total = 0;
+  OkState vm;
+  ok_init(&vm);
+  while (vm.status == OK_RUNNING) {
+    total += meter.cost[program[vm.pc]];
+    ok_tick(&vm);
+  }
+  assert(total == 1 + 10 * (1 + 3 + 1 + 1 + 5 + 1 + 1 + 1));
+
+  for (uint64_t fuel = 0; fuel <= total; fuel++) {
+    OkState ref;
+    uint64_t used = 0;
+    ok_init(&ref);
+    while (ref.status == OK_RUNNING) {
+      uint32_t cost = meter.cost[program[ref.pc]];
+      if (used + cost > fuel) break;
+      used += cost;
+      ok_tick(&ref);
+    }
+
+    ok_meter_init(&meter, fuel);
+    ok_meter_set_cost(&meter, OK_ADD, 1, 3);
+    ok_meter_set_cost(&meter, OK_STR, 1, 5);
+    ok_init(&vm);
+    OkStatus status = ok_run_metered(&vm, &meter);
+
+    // test assertions go here
+    assert(status == (fuel == total ? OK_HALTED : OK_OUT_OF_FUEL));
+    assert(vm.pc == ref.pc && vm.d == ref.d);
+    assert(meter.used == used && meter.fuel == fuel - used);
+  }
+
+  // topping up resumes where it stopped
+  ok_meter_init(&meter, 7);
+  ok_init(&vm);
+  assert(ok_run_metered(&vm, &meter) == OK_OUT_OF_FUEL);
+  ok_meter_refuel(&meter, &vm, 1000);
+  assert(ok_run_metered(&vm, &meter) == OK_HALTED);
+  assert(meter.used == 1 + 10 * 8 && ram[69] == 0);
+
+  // every engine charges the same, alone or profiled, and stops in the same
+  // place, whatever the budget
+  code = ok_code_build(program, sizeof(program));
+  assert(code);
+  OkProf prof;
+  assert(ok_prof_init(&prof, 3));
+  for (int e = 0; e < 3; e++) {
+    for (int profiled = 0; profiled < 2; profiled++) {
+      for (uint64_t fuel = 0; fuel <= total; fuel++) {
+        OkMeter ref;
+        meter_init(&ref, fuel);
+        OkState expect;
+        ok_init(&expect);
+        ok_run_metered(&expect, &ref);
+
+        meter_init(&meter, fuel);
+        OkHooks hooks;
+        ok_hooks_init(&hooks);
+        assert(ok_hooks_add(&hooks, ok_meter_hook, &meter));
+        assert(ok_tier_init(&tier, program, sizeof(program), 0));
+        ok_init(&vm);
+        vm.hooks = &hooks;
+        if (profiled) {
+          ok_prof_run_on(&prof, &vm, UINT64_MAX, engines[e], NULL);
+        } else {
+          engines[e](NULL, &vm, UINT64_MAX);
+        }
+        ok_tier_free(&tier);
+
+        assert(vm.status == expect.status && vm.pc == expect.pc);
+        assert(vm.d == expect.d && meter.used == ref.used);
+        assert(meter.fuel == ref.fuel);
+      }
+    }
+  }
+  assert(prof.samples > 0);
+  ok_prof_free(&prof);
+  ok_code_free(code);
+
+  printf("...test-meter PASSED\n");
+  free(ram);
+  return 0;
+}
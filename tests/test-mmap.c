@@ -0,0 +1,111 @@
+#define OK_IMPLEMENTATION
+#include "../ok_mmap.h"
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// instruction defines go here
+#define LIT1 (0b10001101)
+#define LIT3 (0b10101101)
+#define LOD1 (0b10000111)
+#define STR1 (0b10000110)
+
+#define WINDOW (0x100000) // page aligned for any page size up to 1MB
+#define DATA (3 * 4096 + 100) // bytes in the data file
+
+// program mem goes here, loaded from a file mapped over ROM
+static uint8_t program[] = {
+  // push two bytes of the file, then scribble over its first one
+  LIT3, 0x10, 0x20, 0x01, LOD1,
+  LIT3, 0x10, 0x30, 0x63, LOD1,
+  LIT1, 'Z', LIT3, 0x10, 0x00, 0x00, STR1,
+  0,
+};
+
+static uint8_t* ram;
+static uint8_t* rom;
+
+// externally defined memory functions
+uint8_t ok_mem_read(size_t address) {
+  return ram[address];
+}
+
+void ok_mem_write(size_t address, uint8_t val) {
+  ram[address] = val;
+}
+
+uint8_t ok_fetch(size_t address) {
+  return rom[address];
+}
+
+static void put_file(const char* path, const uint8_t* bytes, size_t len) {
+  FILE* f = fopen(path, "wb");
+  assert(f && fwrite(bytes, 1, len, f) == len);
+  fclose(f);
+}
+
+static uint8_t file_byte(const char* path, size_t at) {
+  FILE* f = fopen(path, "rb");
+  assert(f && fseek(f, (long) at, SEEK_SET) == 0);
+  int byte = fgetc(f);
+  fclose(f);
+  return (uint8_t) byte;
+}
+
+int main() {
+  char rom_path[] = "/tmp/ok-mmap-rom-XXXXXX";
+  char data_path[] = "/tmp/ok-mmap-data-XXXXXX";
+  close(mkstemp(rom_path));
+  close(mkstemp(data_path));
+  put_file(rom_path, program, sizeof(program));
+  uint8_t* data = malloc(DATA);
+  for (size_t i = 0; i < DATA; i++) data[i] = (uint8_t) (i * 7 + 3);
+  put_file(data_path, data, DATA);
+
+  // allocate RAM and ROM, and map the files into them
+  ram = ok_map_alloc();
+  rom = ok_map_alloc();
+  assert(ram && rom);
+  OkMap code, in;
+  assert(ok_map_file(&code, rom, 0, rom_path, 0));
+  assert(ok_map_file(&in, ram, WINDOW, data_path, 0));
+  assert(!ok_map_file(&in, ram, WINDOW + 1, data_path, 0)); // unaligned
+  assert(!ok_map_file(&in, ram, WINDOW, "/nonexistent", 0));
+  assert(in.size == DATA && in.len >= DATA && in.len % 4096 == 0);
+
+  OkState vm;
+  ok_init(&vm);
+  while (vm.status == OK_RUNNING) ok_tick(&vm);
+
+  // test assertions go here
+  assert(vm.status == OK_HALTED);
+  assert(ok_dst_pop(&vm, 1) == data[0x3063]);
+  assert(ok_dst_pop(&vm, 1) == data[0x2001]);
+  assert(memcmp(ram + WINDOW + 1, data + 1, DATA - 1) == 0);
+  assert(ram[WINDOW + DATA] == 0); // past the end of the file
+  assert(ram[WINDOW] == 'Z' && file_byte(data_path, 0) == data[0]);
+
+  // unmapping leaves zeroes behind
+  assert(ok_map_unmap(&in));
+  assert(ram[WINDOW] == 0 && ram[WINDOW + 0x2001] == 0);
+  ram[WINDOW] = 1; // and it's still memory
+  ram[WINDOW] = 0;
+
+  // a read-write window changes the file
+  assert(ok_map_file(&in, ram, WINDOW, data_path, 1));
+  for (size_t i = 0; i < DATA; i += 1000) ok_mem_write(WINDOW + i, 0xee);
+  assert(ok_map_sync(&in));
+  assert(file_byte(data_path, 0) == 0xee && file_byte(data_path, 5000) == 0xee);
+  assert(file_byte(data_path, 5001) == data[5001]);
+  assert(ok_map_unmap(&in) && ok_map_unmap(&code));
+
+  ok_map_release(ram);
+  ok_map_release(rom);
+  free(data);
+  remove(rom_path);
+  remove(data_path);
+
+  printf("...test-mmap PASSED\n");
+  return 0;
+}
@@ -0,0 +1,134 @@
+#define OK_IMPLEMENTATION
+#define OK_OPT_IMPLEMENTATION
+#include "../ok_opt.h"
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// instruction defines go here
+#define LIT1 (0b10001101)
+#define PSH1 (0b10001010)
+#define POP1 (0b10001011)
+#define LIT3 (0b10101101)
+#define ADD1 (0b10000000)
+#define SWP1 (0b10000100)
+#define STR1 (0b10000110)
+#define STR2 (0b10010110)
+#define DUP1 (0b10001000)
+#define DRP1 (0b10001001)
+#define PSH3 (0b10101010)
+#define POP3 (0b10101011)
+#define JMP3 (0b10101100)
+#define FET1 (0b10001110)
+#define NOP (0b10001111)
+
+// naive code, the kind a simple compiler emits
+static uint8_t naive[] = {
+  LIT1, 5, // 0
+  LIT1, 0, // 2
+  ADD1, // 4: adding zero
+  DUP1, // 5
+  DRP1, // 6: dup then drop
+  LIT1, 3, // 7
+  LIT1, 4, // 9
+  ADD1, // 11: constant 3 + 4
+  LIT3, 0, 0, 19, // 12
+  JMP3, // 16: jump to a jump
+  LIT1, 0xee, // 17: unreachable
+  LIT3, 0, 0, 27, // 19
+  JMP3, // 23
+  LIT1, 0xdd, // 24: unreachable
+  NOP, // 26: unreachable
+  SWP1, // 27
+  SWP1, // 28: swapping twice
+  LIT3, 0, 0, 69, // 29
+  STR2, // 33: store 5 and 7 at RAM[69]
+  LIT3, 0, 0, 44, // 34: return address
+  PSH3, // 38
+  LIT3, 0, 0, 45, // 39
+  JMP3, // 43: call the subroutine at 45
+  0, // 44: halt after returning
+  LIT1, 42, // 45
+  LIT3, 0, 0, 71, // 47
+  STR1, // 51: store 42 at RAM[71]
+  POP3, // 52
+  JMP3, // 53: return
+};
+
+static const uint8_t* program;
+static size_t program_len;
+static uint8_t* ram;
+
+// externally defined memory functions
+uint8_t ok_mem_read(size_t address) {
+  return ram[address];
+}
+
+void ok_mem_write(size_t address, uint8_t val) {
+  ram[address] = val;
+}
+
+uint8_t ok_fetch(size_t address) {
+  return address < program_len ? program[address] : 0;
+}
+
+// run a ROM from a clean RAM, returning how many ticks it took
+static size_t run(const uint8_t* rom, size_t len, OkState* vm) {
+  program = rom;
+  program_len = len;
+  memset(ram, 0, OK_MEM_SIZE);
+
+  size_t ticks = 0;
+  ok_init(vm);
+  while (vm->status == OK_RUNNING) {
+    ok_tick(vm);
+    ticks++;
+  }
+  return ticks;
+}
+
+int main() {
+  // allocate RAM
+  ram = calloc(OK_MEM_SIZE, 1);
+  uint8_t out[sizeof(naive)];
+
+  OkOptStats stats;
+  size_t len = ok_opt(naive, sizeof(naive), out, &stats);
+  assert(len > 0 && len < sizeof(naive));
+  assert(stats.reason == NULL);
+  assert(stats.folded > 0 && stats.threaded > 0 && stats.dead > 0);
+
+  OkState before, after;
+  size_t slow = run(naive, sizeof(naive), &before);
+  uint8_t expected[3] = { ram[69], ram[70], ram[71] };
+  size_t fast = run(out, len, &after);
+
+  // test assertions go here
+  assert(before.status == OK_HALTED && after.status == OK_HALTED);
+  assert(expected[0] == 5 && expected[1] == 7 && expected[2] == 42);
+  assert(memcmp(expected, &ram[69], 3) == 0);
+  assert(before.d == after.d && before.r == after.r);
+  assert(fast < slow);
+
+  // reading ROM as data would move the data, so this can't be optimized
+  uint8_t reads_rom[] = { LIT3, 0, 0, 0, FET1, 0 };
+  assert(ok_opt(reads_rom, sizeof(reads_rom), out, &stats) == 0);
+  assert(stats.reason != NULL);
+
+  // a constant pushed to rst equal to a code address (3, after the lit and
+  // drp that get removed) isn't a return address, and mustn't be relocated
+  uint8_t pushes_data[] = {
+    LIT1, 0, DRP1, LIT1, 3, PSH1, // 0, 2, 3, 5
+    LIT1, 7, LIT3, 0, 0, 101, STR1, // 6
+    POP1, LIT3, 0, 0, 100, STR1, 0, // 13: store the 3 at RAM[100]
+  };
+  run(pushes_data, sizeof(pushes_data), &before);
+  assert(before.status == OK_HALTED && ram[100] == 3);
+  assert(ok_opt(pushes_data, sizeof(pushes_data), out, &stats) == 0);
+  assert(stats.reason != NULL);
+
+  printf("...test-opt PASSED\n");
+  free(ram);
+  return 0;
+}
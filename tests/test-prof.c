@@ -0,0 +1,119 @@
+#define OK_IMPLEMENTATION
+#include "../ok_prof.h"
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// instruction defines go here
+#define LIT3 (0b10101101)
+#define PSH3 (0b10101010)
+#define POP3 (0b10101011)
+#define JMP3 (0b10101100)
+#define NOP (0b10001111)
+
+#define MAP "test-prof.map"
+
+// program mem goes here: main calls f forever, f calls g, g spins a bit
+static uint8_t program[] = {
+  LIT3, 0, 0, 10, PSH3, LIT3, 0, 0, 15, JMP3, // 0: main, call f
+  LIT3, 0, 0, 0, JMP3, // 10: loop
+  LIT3, 0, 0, 25, PSH3, LIT3, 0, 0, 27, JMP3, // 15: f, call g
+  POP3, JMP3, // 25: return
+  NOP, NOP, NOP, NOP, NOP, NOP, NOP, NOP, NOP, NOP, // 27: g
+  NOP, NOP, NOP, NOP, NOP, NOP, NOP, NOP, NOP, NOP,
+  POP3, JMP3 // 47: return
+};
+
+// externally defined memory functions
+uint8_t ok_mem_read(size_t address) {
+  (void) address;
+  return 0;
+}
+
+void ok_mem_write(size_t address, uint8_t val) {
+  (void) address;
+  (void) val;
+}
+
+uint8_t ok_fetch(size_t address) {
+  return address < sizeof(program) ? program[address] : 0;
+}
+
+// samples folded into stack, summed over its lines like flame graph tools do
+static uint64_t folded(const OkProf* p, const char* stack) {
+  FILE* f = tmpfile();
+  assert(ok_prof_write(p, f));
+  rewind(f);
+
+  char line[256];
+  uint64_t count = 0;
+  size_t len = strlen(stack);
+  while (fgets(line, sizeof(line), f)) {
+    if (strncmp(line, stack, len) == 0 && line[len] == ' ') {
+      count += strtoull(line + len + 1, NULL, 10);
+    }
+  }
+  fclose(f);
+  return count;
+}
+
+int main() {
+  FILE* map = fopen(MAP, "w");
+  fprintf(map, "000000 main\n00001b g\n00000f f\n");
+  fclose(map);
+
+  // every 7th instruction, over 1000 trips around the loop
+  OkProf p;
+  assert(ok_prof_init(&p, 7));
+  OkState vm;
+  ok_init(&vm);
+  assert(ok_prof_run(&p, &vm, 34 * 1000) == 34 * 1000);
+  assert(p.samples == 34 * 1000 / 7 && p.dropped == 0);
+
+  // without symbols, frames are addresses
+  uint64_t raw = folded(&p, "0x00000a;0x000019;0x00001f");
+  assert(raw > 0);
+
+  // g runs 21 of every 34 instructions with both frames on the stack
+  assert(ok_prof_load_symbols(&p, MAP) && p.nsymbols == 3);
+  uint64_t g = 0;
+  for (size_t i = 0; i < OK_PROF_STACKS; i++) {
+    const OkProfStack* st = &p.stacks[i];
+    if (st->depth == 3 && st->pcs[0] >= 27) g += st->count;
+  }
+  assert(folded(&p, "main;f;g") == g);
+  assert(g > p.samples * 21 / 34 - 10 && g < p.samples * 21 / 34 + 10);
+  assert(folded(&p, "main;f") > 0 && folded(&p, "main") > 0);
+
+  // frames with something else on top of each return address
+  ok_prof_free(&p);
+  assert(ok_prof_init(&p, 0));
+  p.layout.stride = 4;
+  p.layout.offset = 1;
+  ok_init(&vm);
+  vm.pc = 33;
+  ok_rst_push(&vm, 3, 10);
+  ok_rst_push(&vm, 1, 0xee);
+  ok_rst_push(&vm, 3, 25);
+  ok_rst_push(&vm, 1, 0xee);
+  ok_prof_sample(&p, &vm);
+  assert(ok_prof_load_symbols(&p, MAP));
+  assert(folded(&p, "main;f;g") == 1);
+
+  // the timer takes samples on its own
+  ok_prof_free(&p);
+  assert(ok_prof_init(&p, 0));
+  assert(ok_prof_timer(1000));
+  ok_init(&vm);
+  for (int i = 0; i < 10000 && p.samples == 0; i++) {
+    ok_prof_run(&p, &vm, 100000);
+  }
+  assert(ok_prof_timer(0));
+  assert(p.samples > 0);
+
+  printf("...test-prof PASSED\n");
+  ok_prof_free(&p);
+  remove(MAP);
+  return 0;
+}
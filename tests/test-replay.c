@@ -0,0 +1,152 @@
+#define OK_IMPLEMENTATION
+#include "../ok_replay.h"
+#include "../ok_code.h"
+#include "../ok_prof.h"
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// instruction defines go here
+#define LIT1 (0b10001101)
+#define LIT2 (0b10011101)
+#define LIT3 (0b10101101)
+#define ADD1 (0b10000000)
+#define CMP1 (0b10000101)
+#define STR1 (0b10000110)
+#define LOD1 (0b10000111)
+#define DUP1 (0b10001000)
+#define PSH1 (0b10001010)
+#define POP1 (0b10001011)
+#define JMP3_SKIP (0b11101100)
+
+#define PORT (0xffffe0) // reads give random bytes
+
+// program mem goes here
+static uint8_t program[] = {
+  // for i in 0..100: RAM[0x1000 + i] = PORT
+  LIT1, 0, PSH1,
+  LIT3, 0xff, 0xff, 0xe0, LOD1, // 3
+  LIT2, 0x00, 0x10, POP1, DUP1, PSH1, STR1,
+  POP1, LIT1, 1, ADD1, DUP1, PSH1,
+  LIT1, 100, CMP1, LIT3, 0, 0, 3, JMP3_SKIP,
+  0,
+};
+
+static uint8_t* ram;
+static uint8_t* rom;
+static OkReplay replay;
+static int port_reads;
+
+// externally defined memory functions
+uint8_t ok_mem_read(size_t address) {
+  if (address != PORT) return ram[address];
+  if (replay.replaying) return ok_replay_next(&replay, address);
+  port_reads++;
+  uint8_t val = (uint8_t) rand();
+  ok_replay_log(&replay, address, val);
+  return val;
+}
+
+void ok_mem_write(size_t address, uint8_t val) {
+  ram[address] = val;
+}
+
+uint8_t ok_fetch(size_t address) {
+  return rom[address];
+}
+
+// ok_code_run, as an engine for the profiler
+static uint64_t run_code(void* ctx, OkState* s, uint64_t max) {
+  return ok_code_run(ctx, s, max);
+}
+
+int main() {
+  char path[] = "/tmp/ok-replay-XXXXXX";
+  fclose(fdopen(mkstemp(path), "w"));
+
+  // allocate RAM and ROM
+  ram = calloc(OK_MEM_SIZE, 1);
+  rom = calloc(OK_MEM_SIZE, 1);
+  memcpy(rom, program, sizeof(program));
+
+  // record a run
+  OkHooks hooks;
+  ok_hooks_init(&hooks);
+  assert(ok_hooks_add(&hooks, ok_replay_hook, &replay));
+  assert(ok_replay_record(&replay, path));
+  OkState vm;
+  ok_init(&vm);
+  vm.hooks = &hooks;
+  uint64_t ran = ok_run(&vm, UINT64_MAX);
+  assert(ok_replay_close(&replay));
+  assert(vm.status == OK_HALTED && port_reads == 100 && replay.reads == 100);
+  uint8_t recorded[100];
+  memcpy(recorded, ram + 0x1000, 100);
+
+  FILE* f = fopen(path, "rb");
+  fseek(f, 0, SEEK_END);
+  assert(ftell(f) == 4 + 6 + 99 * 3); // 3 bytes a read once it's polling
+  fclose(f);
+
+  // replay it without the device
+  memset(ram, 0, OK_MEM_SIZE);
+  assert(ok_replay_open(&replay, path));
+  ok_init(&vm);
+  vm.hooks = &hooks;
+  assert(ok_run(&vm, UINT64_MAX) == ran);
+  assert(ok_replay_close(&replay));
+  assert(port_reads == 100 && replay.reads == 100);
+  assert(memcmp(ram + 0x1000, recorded, 100) == 0);
+
+  // and under another engine, profiled at the same time
+  OkProf prof;
+  assert(ok_prof_init(&prof, 10));
+  OkCode* code = ok_code_build(rom, OK_MEM_SIZE);
+  assert(code);
+  memset(ram, 0, OK_MEM_SIZE);
+  assert(ok_replay_open(&replay, path));
+  ok_init(&vm);
+  vm.hooks = &hooks;
+  assert(ok_prof_run_on(&prof, &vm, UINT64_MAX, run_code, code) == ran);
+  assert(ok_replay_close(&replay));
+  assert(replay.reads == 100 && prof.samples == ran / 10);
+  assert(memcmp(ram + 0x1000, recorded, 100) == 0);
+  ok_code_free(code);
+  ok_prof_free(&prof);
+
+  // a run loop that doesn't keep the clock only checks addresses
+  memset(ram, 0, OK_MEM_SIZE);
+  assert(ok_replay_open(&replay, path));
+  replay.timed = 0;
+  ok_init(&vm);
+  while (vm.status == OK_RUNNING) ok_tick(&vm);
+  assert(ok_replay_close(&replay));
+  assert(memcmp(ram + 0x1000, recorded, 100) == 0);
+
+  // but with the clock kept, reads at other times are caught
+  assert(ok_replay_open(&replay, path));
+  replay.clock = 1;
+  ok_init(&vm);
+  vm.hooks = &hooks;
+  ok_run(&vm, UINT64_MAX);
+  assert(replay.diverged && replay.reads == 0);
+  assert(!ok_replay_close(&replay));
+
+  // and so are reads left over
+  rom[22] = 50;
+  assert(ok_replay_open(&replay, path));
+  ok_init(&vm);
+  vm.hooks = &hooks;
+  ok_run(&vm, UINT64_MAX);
+  assert(!replay.diverged && replay.reads == 50);
+  assert(!ok_replay_close(&replay));
+  assert(port_reads == 100);
+
+  free(ram);
+  free(rom);
+  remove(path);
+
+  printf("...test-replay PASSED\n");
+  return 0;
+}
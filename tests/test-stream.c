@@ -0,0 +1,125 @@
+#define OK_IMPLEMENTATION
+#include "../ok_stream.h"
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// instruction defines go here
+#define LIT1 (0b10001101)
+#define LIT3 (0b10101101)
+#define STR1 (0b10000110)
+
+// program mem goes here: print "hi\n" through the console
+static uint8_t program[] = {
+  LIT1, 'h', LIT3, 0, 0xba, 0xbe, STR1,
+  LIT1, 'i', LIT3, 0, 0xba, 0xbe, STR1,
+  LIT1, '\n', LIT3, 0, 0xba, 0xbe, STR1,
+  0
+};
+
+static uint8_t* ram;
+static OkStream st;
+
+// externally defined memory functions
+uint8_t ok_mem_read(size_t address) {
+  if (address - OK_STREAM_BASE < OK_STREAM_SIZE) {
+    return ok_stream_read(&st, address - OK_STREAM_BASE);
+  }
+  return ram[address];
+}
+
+void ok_mem_write(size_t address, uint8_t val) {
+  if (address - OK_STREAM_BASE < OK_STREAM_SIZE) {
+    ok_stream_write(&st, address - OK_STREAM_BASE, val);
+    return;
+  }
+  if (address == OK_STREAM_CONSOLE) {
+    ok_stream_write(&st, OK_STREAM_OUT, val);
+  }
+  ram[address] = val;
+}
+
+uint8_t ok_fetch(size_t address) {
+  return address < sizeof(program) ? program[address] : 0;
+}
+
+// what has been written to the pipe so far
+static size_t drain(int fd, char* out) {
+  ssize_t got = read(fd, out, 255);
+  size_t len = got > 0 ? (size_t) got : 0;
+  out[len] = 0;
+  return len;
+}
+
+// write a word register the way `str` would, highest address first
+static void set_word(size_t offset, size_t val) {
+  for (int i = OK_WORD_SIZE - 1; i >= 0; i--) {
+    ok_mem_write(OK_STREAM_BASE + offset + i, (uint8_t) val);
+    val >>= 8;
+  }
+}
+
+static void run() {
+  OkState vm;
+  ok_init(&vm);
+  while (vm.status == OK_RUNNING) ok_tick(&vm);
+}
+
+int main() {
+  ram = calloc(OK_MEM_SIZE, 1);
+  int out[2], in[2];
+  char got[256];
+  assert(pipe(out) == 0 && pipe(in) == 0);
+  fcntl(out[0], F_SETFL, O_NONBLOCK);
+
+  // fully buffered output waits for a flush
+  ok_stream_init(&st, ram, in[0], out[1], 0);
+  run();
+  assert(drain(out[0], got) == 0);
+  assert(ok_stream_flush(&st));
+  assert(drain(out[0], got) == 3);
+  assert(strcmp(got, "hi\n") == 0);
+
+  // line buffered output goes out at the newline
+  ok_stream_init(&st, ram, in[0], out[1], 1);
+  run();
+  assert(drain(out[0], got) == 3 && strcmp(got, "hi\n") == 0);
+
+  // a ring is drained once it's half full, and on a flush
+  set_word(OK_STREAM_RING, 0x1000);
+  set_word(OK_STREAM_RING_SIZE, 8);
+  memcpy(ram + 0x1000, "abcdefgh", 8);
+  set_word(OK_STREAM_HEAD, 3);
+  assert(drain(out[0], got) == 0);
+  set_word(OK_STREAM_HEAD, 4);
+  assert(ok_get_bytes(st.regs, OK_STREAM_TAIL, OK_WORD_SIZE) == 4);
+  memcpy(ram + 0x1000, "ABC", 3); // bytes 8-10 wrap around
+  set_word(OK_STREAM_HEAD, 11);
+  ok_mem_write(OK_STREAM_BASE + OK_STREAM_STATUS, 1);
+  assert(drain(out[0], got) == 11 && strcmp(got, "abcdefghABC") == 0);
+  assert(ok_mem_read(OK_STREAM_BASE + OK_STREAM_TAIL + OK_WORD_SIZE - 1) == 11);
+
+  // input comes in through a read-ahead buffer, and only through IN: the
+  // bytes around the console port are plain RAM
+  assert(write(in[1], "ok", 2) == 2);
+  close(in[1]);
+  ram[OK_STREAM_CONSOLE + 1] = 0x5a;
+  assert(ok_mem_read(OK_STREAM_CONSOLE + 1) == 0x5a);
+  assert(ok_mem_read(OK_STREAM_CONSOLE) == '\n');
+  assert(ok_mem_read(OK_STREAM_BASE + OK_STREAM_STATUS) == OK_STREAM_READY);
+  assert(st.in.len == 2);
+  assert(ok_mem_read(OK_STREAM_BASE + OK_STREAM_IN) == 'o');
+  assert(ok_mem_read(OK_STREAM_BASE + OK_STREAM_IN) == 'k');
+  assert(ok_mem_read(OK_STREAM_BASE + OK_STREAM_STATUS) == OK_STREAM_EOF);
+  assert(ok_mem_read(OK_STREAM_BASE + OK_STREAM_IN) == 0);
+
+  printf("...test-stream PASSED\n");
+  close(out[0]);
+  close(out[1]);
+  close(in[0]);
+  free(ram);
+  return 0;
+}
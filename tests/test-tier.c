@@ -0,0 +1,120 @@
+#define OK_IMPLEMENTATION
+#include "../ok_tier.h"
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// instruction defines go here
+#define LIT1 (0b10001101)
+#define LIT2 (0b10011101)
+#define LIT3 (0b10101101)
+#define ADD1 (0b10000000)
+#define CMP1 (0b10000101)
+#define STR1 (0b10000110)
+#define DUP1 (0b10001000)
+#define PSH1 (0b10001010)
+#define POP1 (0b10001011)
+#define JMP3_SKIP (0b11101100)
+
+// program mem goes here
+static uint8_t program[] = {
+  // for i in 0..200: RAM[i] = i * (i + 1) / 2, mod 256
+  LIT1, 0, LIT1, 0, PSH1,
+  POP1, DUP1, PSH1, ADD1, // 5
+  DUP1, LIT2, 0, 0, POP1, DUP1, PSH1, STR1,
+  POP1, LIT1, 1, ADD1, DUP1, PSH1,
+  LIT1, 200, CMP1, LIT3, 0, 0, 5, JMP3_SKIP,
+  0,
+};
+
+static uint8_t* ram;
+static uint8_t* rom;
+static size_t written[4096];
+static size_t nwritten;
+
+// externally defined memory functions
+uint8_t ok_mem_read(size_t address) {
+  return ram[address % OK_MEM_SIZE];
+}
+
+void ok_mem_write(size_t address, uint8_t val) {
+  if (nwritten < 4096) written[nwritten++] = address % OK_MEM_SIZE;
+  ram[address % OK_MEM_SIZE] = val;
+}
+
+uint8_t ok_fetch(size_t address) {
+  return rom[address % OK_MEM_SIZE];
+}
+
+// run rom under ok_tick and ok_tier_run, in chunks of step instructions,
+// and check both end up in the same state
+static void compare(size_t len, uint32_t threshold, uint64_t max,
+                    uint64_t step, OkTierStats* stats) {
+  static uint8_t expect[4096];
+  OkState a, b;
+
+  ok_init(&a);
+  nwritten = 0;
+  for (uint64_t i = 0; i < max && a.status == OK_RUNNING; i++) ok_tick(&a);
+  size_t n = nwritten;
+  for (size_t i = 0; i < n; i++) expect[i] = ram[written[i]];
+  for (size_t i = 0; i < n; i++) ram[written[i]] = 0;
+
+  OkTier t;
+  assert(ok_tier_init(&t, rom, len, threshold));
+  ok_init(&b);
+  nwritten = 0;
+  uint64_t ran = 0;
+  while (ran < max && b.status == OK_RUNNING) {
+    ran += ok_tier_run(&t, &b, max - ran < step ? max - ran : step);
+  }
+  assert(a.d == b.d && memcmp(a.dst, b.dst, 256) == 0);
+  assert(a.r == b.r && memcmp(a.rst, b.rst, 256) == 0);
+  assert(a.pc == b.pc && a.status == b.status);
+  assert(nwritten == n);
+  for (size_t i = 0; i < n; i++) assert(ram[written[i]] == expect[i]);
+  for (size_t i = 0; i < n; i++) ram[written[i]] = 0;
+
+  assert(t.stats.interpreted + t.stats.decoded == ran);
+  assert(t.stats.promotions == 0 || t.code != NULL);
+  if (stats) *stats = t.stats;
+  ok_tier_free(&t);
+}
+
+int main() {
+  // allocate RAM and ROM
+  ram = calloc(OK_MEM_SIZE, 1);
+  rom = calloc(OK_MEM_SIZE, 1);
+  memcpy(rom, program, sizeof(program));
+
+  // the loop goes hot after 50 trips, and stays decoded until it ends
+  OkTierStats st;
+  compare(OK_MEM_SIZE, OK_TIER_THRESHOLD, UINT64_MAX, UINT64_MAX, &st);
+  assert(st.promotions == 1 && st.enters == 1 && st.exits == 1);
+  assert(st.interpreted < st.decoded);
+
+  // never promoting is plain ticking, and short runs never pay for decoding
+  compare(OK_MEM_SIZE, UINT32_MAX, UINT64_MAX, UINT64_MAX, &st);
+  assert(st.decoded == 0 && st.promotions == 0);
+  compare(OK_MEM_SIZE, OK_TIER_THRESHOLD, 500, UINT64_MAX, &st);
+  assert(st.decoded == 0 && st.promotions == 0);
+
+  // switching between runs of any length, at any threshold
+  for (uint64_t step = 1; step < 40; step += 3) {
+    compare(OK_MEM_SIZE, step % 5, UINT64_MAX, step, NULL);
+  }
+
+  // random code jumps all over, through every instruction and width
+  srand(1);
+  for (int round = 0; round < 3000; round++) {
+    for (int i = 0; i < 96; i++) rom[i] = (uint8_t) (rand() | 0x80);
+    compare(96, rand() % 4, 2000, 1 + rand() % 50, NULL);
+  }
+
+  free(ram);
+  free(rom);
+
+  printf("...test-tier PASSED\n");
+  return 0;
+}